@@ -15,6 +15,8 @@ layout (std140, set = 1, binding = 0) uniform MVP {
     mat4 projection;
 } mvp;
 
+invariant gl_Position;
+
 void main()
 {
     gl_Position = mvp.projection * mvp.view * mvp.model * vec4(aPos, 1.0f);
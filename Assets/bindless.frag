@@ -0,0 +1,13 @@
+#version 450
+
+#extension GL_EXT_nonuniform_qualifier : require
+
+layout (set = 1, binding = 0) uniform sampler2D textures[];
+layout (push_constant) uniform PushConsts {
+    uint texIndex;
+} pushConsts;
+layout (location = 0) in vec2 texcoord;
+layout (location = 0) out vec4 outColor;
+void main() {
+   outColor = texture(textures[nonuniformEXT(pushConsts.texIndex)], texcoord);
+}
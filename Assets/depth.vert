@@ -0,0 +1,19 @@
+#version 400
+
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_ARB_shading_language_420pack : enable
+
+layout (location = 0) in vec3 aPos;
+
+layout (std140, set = 0, binding = 0) uniform MVP {
+    mat4 model;
+    mat4 view;
+    mat4 projection;
+} mvp;
+
+invariant gl_Position;
+
+void main()
+{
+    gl_Position = mvp.projection * mvp.view * mvp.model * vec4(aPos, 1.0f);
+}
@@ -4,24 +4,32 @@
 layout (binding = 0, rgba8) uniform image2D inputImage;
 layout (binding = 1, rgba8) uniform image2D outputImage;
 
+// Odd kernel width, baked into the pipeline with a specialization constant.
+layout (constant_id = 0) const int KERNEL_SIZE = 5;
+
+// Binomial weights, 5 gives the 1 4 6 4 1 / 16 kernel from
+// https://learnopengl.com/Advanced-Lighting/Bloom
+float Weight(int k) {
+    float weight = 1.0;
+    for (int i = 1; i <= k; i++) {
+        weight = weight * float(KERNEL_SIZE - k - 1 + i) / float(i);
+    }
+    return weight / exp2(float(KERNEL_SIZE - 1));
+}
+
 void main() {
     ivec2 pixelCoords = ivec2(0,0);
 
-    vec4 pixel = imageLoad(inputImage, pixelCoords);
-
     vec4 blurredPixel = vec4(0.0);
 
-    // Apply a 5x5 Gaussian blur
-    for (int x = -2; x <= 2; x++) {
-        for (int y = -2; y <= 2; y++) {
+    const int radius = KERNEL_SIZE / 2;
+    for (int x = -radius; x <= radius; x++) {
+        for (int y = -radius; y <= radius; y++) {
             // Get the pixel offset by the kernel
             vec4 neighbor = imageLoad(inputImage, pixelCoords + ivec2(x, y));
 
-            // Gaussian kernel values from https://learnopengl.com/Advanced-Lighting/Bloom
-            float kernel[5] = float[](1.0 / 16.0, 4.0 / 16.0, 6.0 / 16.0, 4.0 / 16.0, 1.0 / 16.0);
-
             // Multiply the neighbor by the corresponding kernel value
-            neighbor *= kernel[x + 2] * kernel[y + 2];
+            neighbor *= Weight(x + radius) * Weight(y + radius);
 
             // Add the neighbor to the blurred pixel
             blurredPixel += neighbor;
@@ -30,4 +38,4 @@ void main() {
 
     // Write the blurred pixel to the output image
     imageStore(outputImage, pixelCoords, blurredPixel);
-}
\ No newline at end of file
+}
@@ -29,6 +29,8 @@ layout (location = 2) out vec3 outUV;
 layout (location = 3) out vec3 outViewVec;
 layout (location = 4) out vec3 outLightVec;
 
+invariant gl_Position;
+
 void main() 
 {
 	outColor = vec3(1.0);
@@ -10,6 +10,8 @@ layout (location = 3) in vec2 inColor;
 
 layout (location = 0) out vec3 outColor;
 
+invariant gl_Position;
+
 void main() {
     gl_Position = pushConsts.mvp * vec4(inPos[0], 1.0, 1.0);
     outColor = vec3(inColor, 1.0);
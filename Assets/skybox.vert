@@ -25,6 +25,7 @@ layout (location = 1) in vec3 normal;
 layout (location = 2) in vec3 uv;
 layout (location = 0) out vec2 texcoord;
 layout (location = 1) out vec4 lightColor;
+invariant gl_Position;
 void main() {
 	mat4 mat = mvp.perpective * mvp.view * mvp.model;
 	gl_Position = mat * vec4(position, 1.0f);
@@ -14,6 +14,7 @@ layout (location = 1) in vec3 normal;
 layout (location = 2, component=0) in float uv_x;
 layout (location = 2, component=1) in float uv_y;
 layout (location = 0) out vec2 texcoord;
+invariant gl_Position;
 void main() {
 	mat4 mat = mvp.perpective * mvp.view * mvp.model;
 	texcoord = vec2(uv_x, 1.f - uv_y);
@@ -4,4 +4,8 @@ constexpr int WINDOW_WIDTH = 1280;
 constexpr int WINDOW_HEIGHT = 900;
 constexpr int WINDOW_FPS = 60;
 #define WINDOW_TITLE ("VPP")
+#define PIPELINE_CACHE_FILE ("pipeline.cache")
+// Built from Assets by the ShaderCompiler project.
+#define SHADER_ARCHIVE_FILE ("shaders.vpa")
 constexpr int FRAME_LAG = 2;
+constexpr int MAX_BINDLESS_TEXTURES = 4096;
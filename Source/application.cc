@@ -11,7 +11,9 @@
 #include "impl/DrawCmd.h"
 #include "impl/Image.h"
 #include "impl/Pipeline.h"
+#include "impl/ShaderArchive.h"
 #include "impl/ShaderData.h"
+#include "impl/ShaderWatcher.h"
 #include "impl/VPPImage.h"
 #include "impl/VPPShader.h"
 #include "impl/Window.h"
@@ -30,6 +32,17 @@ static impl::DrawParam* cmd = nullptr;
 static impl::SamplerTexture* tex1 = nullptr;
 static impl::SamplerTexture* tex2 = nullptr;
 static impl::UniformBuffer* transform = nullptr;
+static impl::UniformWriter* transformWriter = nullptr;
+static impl::UniformWriter::Handle modelHandle = 0;
+static impl::UniformWriter::Handle viewHandle = 0;
+static impl::UniformWriter::Handle projectionHandle = 0;
+static impl::ShaderWatcher* watcher = nullptr;
+
+static void BindResources() {
+  cmd->BindTexture(0, 0, 0);
+  cmd->BindTexture(1, 0, 1);
+  cmd->BindUniform(0, 1, 0);
+}
 
 Application::Application() {}
 
@@ -136,14 +149,32 @@ void Application::OnStart() {
                    4, reader.pixel());
 
   transform = new impl::UniformBuffer(g_Device);
-  transform->SetData(sizeof(glm::mat4) * 3);
 
   basicPipe = new impl::Pipeline(g_Device);
+  glsl::CompileOptions options{};
+  options.optimize = glsl::OptimizeLevel::kPerformance;
+  options.strip_debug = true;
   {
-    glsl::Reader reader({"basic.vert", "basic.frag"});
     glsl::MetaData data{};
-    if (reader.GetData(&data))
+    glsl::Archive archive{};
+    bool loaded =
+        archive.Open(SHADER_ARCHIVE_FILE) && archive.GetData("basic", &data);
+    if (!loaded) {
+      glsl::Reader reader({"basic.vert", "basic.frag"}, options);
+      loaded = reader.GetData(&data);
+    }
+    if (loaded)
       basicPipe->SetShader(data);
+
+    glsl::Uniform mvp{};
+    if (const auto* block = data.GetUniform("MVP")) {
+      mvp = *block;
+    }
+    transform->SetData(mvp.block_size ? mvp.block_size : sizeof(glm::mat4) * 3);
+    transformWriter = new impl::UniformWriter(*transform, mvp);
+    modelHandle = transformWriter->GetHandle("model");
+    viewHandle = transformWriter->GetHandle("view");
+    projectionHandle = transformWriter->GetHandle("projection");
     basicPipe->SetVertexAttrib(0, 0, vk::Format::eR32G32B32Sfloat, 0);
     basicPipe->SetVertexAttrib(1, 0, vk::Format::eR32G32Sfloat,
                                (3 * sizeof(float)));
@@ -158,11 +189,20 @@ void Application::OnStart() {
 
   cmd->SetTexture(0, *tex1);
   cmd->SetTexture(1, *tex2);
-  cmd->BindTexture(0, 0, 0);
-  cmd->BindTexture(1, 0, 1);
-
   cmd->SetUniform(0, *transform);
-  cmd->BindUniform(0, 1, 0);
+  BindResources();
+
+  // Edits to the sources or their includes are picked up while running.
+  watcher = new impl::ShaderWatcher();
+  watcher->Watch(
+      {"basic.vert", "basic.frag"},
+      [](const glsl::MetaData& data) {
+        if (basicPipe->Reload(data)) {
+          cmd->SetPipeline(*basicPipe);
+          BindResources();
+        }
+      },
+      options);
 
   std::vector<vk::ClearValue> clearValues = {
       vk::ClearValue().setColor(vk::ClearColorValue{0.2f, 0.3f, 0.3f, 1.0f}),
@@ -216,13 +256,18 @@ void Application::OnLoop() {
   glm::mat4 projection = glm::perspective(
       glm::radians(45.0f), (float)WINDOW_WIDTH / (float)WINDOW_HEIGHT, 0.1f, 100.0f);
 
-  glm::mat4 bytes[3] = {model, view, projection};
-  transform->UpdateData(bytes, sizeof(glm::mat4) * 3);
+  transformWriter->Set(modelHandle, model);
+  transformWriter->Set(viewHandle, view);
+  transformWriter->Set(projectionHandle, projection);
+  transformWriter->Flush();
 
+  watcher->Update();
   g_Device->Draw();
 }
 
 void Application::OnEnd() {
+  delete watcher;
+  delete transformWriter;
   delete transform;
   delete tex2;
   delete tex1;
@@ -6,29 +6,46 @@ namespace impl {
 CommonBuffer::CommonBuffer(Device* parent) : DeviceResource(parent) {}
 
 CommonBuffer::~CommonBuffer() {
-  if (buffer_) {
-    device().destroy(buffer_);
-  }
-  if (memory_) {
-    device().free(memory_);
-  }
+  Release(buffer_);
+  Release(memory_);
 }
 
-bool CommonBuffer::SetLocalData(vk::BufferUsageFlags usage, const void* data,
-                           size_t size) {
-  buffer_ = CreateBuffer(usage | vk::BufferUsageFlagBits::eTransferDst, size);
+bool CommonBuffer::CreateLocal(vk::BufferUsageFlags usage, size_t size) {
+  Release(buffer_);
+  Release(memory_);
+  revision_++;
+
+  usage_ = usage | vk::BufferUsageFlagBits::eTransferDst |
+           vk::BufferUsageFlagBits::eTransferSrc;
+  capacity_ = size;
+  buffer_ = CreateBuffer(usage_, size);
   if (!buffer_) {
     return false;
   }
 
+  auto cls = MemoryClass::kOther;
+  if (usage & vk::BufferUsageFlagBits::eVertexBuffer) {
+    cls = MemoryClass::kVertex;
+  } else if (usage & vk::BufferUsageFlagBits::eIndexBuffer) {
+    cls = MemoryClass::kIndex;
+  } else if (usage & vk::BufferUsageFlagBits::eStorageBuffer) {
+    cls = MemoryClass::kStorage;
+  }
   memory_ = CreateMemory(device().getBufferMemoryRequirements(buffer_),
-                         vk::MemoryPropertyFlagBits::eDeviceLocal);
+                         vk::MemoryPropertyFlagBits::eDeviceLocal, cls, this);
   if (!memory_) {
     return false;
   }
 
-  device().bindBufferMemory(buffer_, memory_, 0);
+  device().bindBufferMemory(buffer_, memory_.memory(), memory_.offset);
+  return true;
+}
 
+bool CommonBuffer::SetLocalData(vk::BufferUsageFlags usage, const void* data,
+                           size_t size) {
+  if (!CreateLocal(usage, size)) {
+    return false;
+  }
   auto stageBuffer = CreateStageBuffer(data, size);
   return stageBuffer->CopyToBuffer(buffer_);
 }
@@ -36,7 +53,13 @@ bool CommonBuffer::SetLocalData(vk::BufferUsageFlags usage, const void* data,
 bool CommonBuffer::SetGlobalData(vk::BufferUsageFlags usage, const void* data, size_t size) {
   auto result = vk::Result::eSuccess;
 
-  buffer_ = CreateBuffer(vk::BufferUsageFlagBits::eUniformBuffer, size);
+  Release(buffer_);
+  Release(memory_);
+  revision_++;
+
+  usage_ = vk::BufferUsageFlagBits::eUniformBuffer;
+  capacity_ = size;
+  buffer_ = CreateBuffer(usage_, size);
   if (!buffer_) {
     return false;
   }
@@ -45,21 +68,41 @@ bool CommonBuffer::SetGlobalData(vk::BufferUsageFlags usage, const void* data, s
 
   vk::MemoryPropertyFlags memFlags = vk::MemoryPropertyFlagBits::eHostVisible |
                                      vk::MemoryPropertyFlagBits::eHostCoherent;
-  memory_ = CreateMemory(req, memFlags);
+  memory_ = CreateMemory(req, memFlags, MemoryClass::kUniform);
   if (!memory_) {
     return false;
   }
 
-  device().bindBufferMemory(buffer_, memory_, 0);
+  device().bindBufferMemory(buffer_, memory_.memory(), memory_.offset);
 
   if (data) {
-    void* mapData = device().mapMemory(memory_, 0, size, vk::MemoryMapFlags());
+    void* mapData = device().mapMemory(memory_.memory(), memory_.offset, size,
+                                       vk::MemoryMapFlags());
     if (mapData) {
       memcpy(mapData, data, size);
     }
-    device().unmapMemory(memory_);
+    device().unmapMemory(memory_.memory());
+  }
+
+  return true;
+}
+
+bool CommonBuffer::Relocate(const vk::CommandBuffer& cmd,
+                            const Allocation& dst) {
+  auto buffer = CreateBuffer(usage_, capacity_);
+  if (!buffer) {
+    return false;
   }
+  device().bindBufferMemory(buffer, dst.memory(), dst.offset);
+
+  auto copyRegion = vk::BufferCopy().setSize(capacity_);
+  cmd.copyBuffer(buffer_, buffer, 1, &copyRegion);
 
+  Release(buffer_);
+  Release(memory_);
+  buffer_ = buffer;
+  memory_ = dst;
+  revision_++;
   return true;
 }
 
@@ -88,12 +131,171 @@ bool UniformBuffer::SetData(size_t size) {
 
 void UniformBuffer::UpdateData(void* data, size_t size) {
     if (!data || !size) { return; }
-    auto mapData = device().mapMemory(memory(), 0, size_);
+    auto mapData = device().mapMemory(memory(), offset(), size_);
     size_t safeSize = std::min(size_, size);
     memcpy(mapData, data, safeSize);
     device().unmapMemory(memory());
 }
 
+bool UniformBuffer::UpdateData(size_t offset, const void* data,
+                               size_t size) {
+  if (!data || !size || offset + size > size_) {
+    return false;
+  }
+  auto mapData = device().mapMemory(memory(), this->offset() + offset, size);
+  if (!mapData) {
+    return false;
+  }
+  memcpy(mapData, data, size);
+  device().unmapMemory(memory());
+  return true;
+}
+
+const vk::PipelineStageFlags kStorageStages =
+    vk::PipelineStageFlagBits::eDrawIndirect |
+    vk::PipelineStageFlagBits::eVertexInput |
+    vk::PipelineStageFlagBits::eVertexShader |
+    vk::PipelineStageFlagBits::eFragmentShader |
+    vk::PipelineStageFlagBits::eComputeShader;
+const vk::AccessFlags kStorageAccess =
+    vk::AccessFlagBits::eIndirectCommandRead |
+    vk::AccessFlagBits::eVertexAttributeRead |
+    vk::AccessFlagBits::eIndexRead | vk::AccessFlagBits::eShaderRead |
+    vk::AccessFlagBits::eShaderWrite;
+
+bool StorageBuffer::SetData(const void* data, size_t size,
+                            vk::BufferUsageFlags extra) {
+  if (!size) {
+    return false;
+  }
+  size_ = size;
+  auto usage = vk::BufferUsageFlagBits::eStorageBuffer | extra;
+  if (data) {
+    return SetLocalData(usage, data, size);
+  }
+  if (!CreateLocal(usage, size)) {
+    return false;
+  }
+  auto cmd = BeginOnceCmd();
+  if (!cmd) {
+    return false;
+  }
+  cmd.fillBuffer(buffer(), 0, VK_WHOLE_SIZE, 0);
+  auto toShader = vk::BufferMemoryBarrier()
+                      .setSrcAccessMask(vk::AccessFlagBits::eTransferWrite)
+                      .setDstAccessMask(kStorageAccess)
+                      .setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+                      .setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+                      .setBuffer(buffer())
+                      .setOffset(0)
+                      .setSize(VK_WHOLE_SIZE);
+  cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, kStorageStages,
+                      (vk::DependencyFlagBits)0, 0, nullptr, 1, &toShader, 0,
+                      nullptr);
+  EndOnceCmd(cmd);
+  return true;
+}
+
+bool StorageBuffer::Upload(size_t offset, const void* data, size_t size) {
+  if (!data || !size || offset + size > size_) {
+    return false;
+  }
+  auto stageBuffer = CreateStageBuffer(data, size);
+  auto cmd = BeginOnceCmd();
+  if (!cmd) {
+    return false;
+  }
+  auto toTransfer = vk::BufferMemoryBarrier()
+                        .setSrcAccessMask(kStorageAccess)
+                        .setDstAccessMask(vk::AccessFlagBits::eTransferWrite)
+                        .setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+                        .setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+                        .setBuffer(buffer())
+                        .setOffset(offset)
+                        .setSize(size);
+  cmd.pipelineBarrier(kStorageStages, vk::PipelineStageFlagBits::eTransfer,
+                      (vk::DependencyFlagBits)0, 0, nullptr, 1, &toTransfer, 0,
+                      nullptr);
+  auto region = vk::BufferCopy().setDstOffset(offset).setSize(size);
+  cmd.copyBuffer(stageBuffer->buffer(), buffer(), 1, &region);
+  auto toShader = toTransfer;
+  toShader.setSrcAccessMask(vk::AccessFlagBits::eTransferWrite)
+      .setDstAccessMask(kStorageAccess);
+  cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, kStorageStages,
+                      (vk::DependencyFlagBits)0, 0, nullptr, 1, &toShader, 0,
+                      nullptr);
+  EndOnceCmd(cmd);
+  return true;
+}
+
+bool StorageBuffer::Readback(size_t offset, void* data, size_t size) const {
+  if (!data || !size || offset + size > size_) {
+    return false;
+  }
+  const auto& src = buffer();
+  return CopyToHost(
+      [&src, offset, size](const vk::CommandBuffer& cmd,
+                           const vk::Buffer& dst) {
+        auto region = vk::BufferCopy().setSrcOffset(offset).setSize(size);
+        cmd.copyBuffer(src, dst, 1, &region);
+      },
+      data, size);
+}
+
+UniformWriter::UniformWriter(UniformBuffer& buffer, const glsl::Uniform& block)
+    : buffer_(buffer), members_(block.members), data_(block.block_size, 0) {}
+
+UniformWriter::Handle UniformWriter::GetHandle(const char* name) const {
+  for (size_t i = 0; i < members_.size(); i++) {
+    if (members_[i].name == name) {
+      return (Handle)i;
+    }
+  }
+  return kInvalidHandle;
+}
+
+bool UniformWriter::Set(Handle handle, const void* data, uint32_t size) {
+  if (handle >= members_.size() || !data) {
+    return false;
+  }
+  const auto& member = members_[handle];
+  if (size > member.size || member.offset + size > data_.size()) {
+    return false;
+  }
+  auto* dst = data_.data() + member.offset;
+  if (memcmp(dst, data, size) == 0) {
+    return true;
+  }
+  memcpy(dst, data, size);
+
+  // Ranges that overlap or touch are merged.
+  uint32_t begin = member.offset;
+  uint32_t end = member.offset + size;
+  auto iter = dirty_.begin();
+  while (iter != dirty_.end() && iter->second < begin) {
+    ++iter;
+  }
+  while (iter != dirty_.end() && iter->first <= end) {
+    begin = std::min(begin, iter->first);
+    end = std::max(end, iter->second);
+    iter = dirty_.erase(iter);
+  }
+  dirty_.insert(iter, std::make_pair(begin, end));
+  return true;
+}
+
+uint32_t UniformWriter::Flush() {
+  uint32_t bytes = 0;
+  for (const auto& e : dirty_) {
+    if (buffer_.UpdateData(e.first, data_.data() + e.first,
+                           e.second - e.first)) {
+      bytes += e.second - e.first;
+    }
+  }
+  dirty_.clear();
+  return bytes;
+}
+
 void VertexArray::BindBuffer(const VertexBuffer& vertex) {
   vertices_.push_back(&vertex);
 }
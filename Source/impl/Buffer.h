@@ -3,24 +3,35 @@
 #include <vulkan/vulkan.hpp>
 
 #include "Device.h"
+#include "ShaderData.h"
 
 namespace VPP {
 namespace impl {
 
-class CommonBuffer : public DeviceResource {
+class CommonBuffer : public DeviceResource, public Relocatable {
 public:
   const vk::Buffer& buffer() const { return buffer_; }
-  const vk::DeviceMemory& memory() const { return memory_; }
+  vk::DeviceMemory memory() const { return memory_.memory(); }
+  vk::DeviceSize offset() const { return memory_.offset; }
+  // Changes whenever buffer() is replaced, descriptors must be rewritten.
+  uint32_t revision() const { return revision_; }
 
 protected:
   CommonBuffer(Device* parent);
   ~CommonBuffer();
+  // Device local buffer with undefined contents.
+  bool CreateLocal(vk::BufferUsageFlags usage, size_t size);
   bool SetLocalData(vk::BufferUsageFlags usage, const void* data, size_t size);
   bool SetGlobalData(vk::BufferUsageFlags usage, const void* data, size_t size);
 
 private:
+  bool Relocate(const vk::CommandBuffer& cmd, const Allocation& dst) override;
+
   vk::Buffer buffer_{};
-  vk::DeviceMemory memory_{};
+  Allocation memory_{};
+  vk::BufferUsageFlags usage_{};
+  size_t capacity_ = 0;
+  uint32_t revision_ = 0;
 };
 
 class VertexBuffer : public CommonBuffer {
@@ -70,10 +81,64 @@ public:
   bool SetData(size_t size);
   size_t size() const { return size_; }
   void UpdateData(void* data, size_t size);
+  // Writes bytes [offset, offset + size) only.
+  bool UpdateData(size_t offset, const void* data, size_t size);
+
+private:
+  size_t size_ = 0;
+  std::vector<uint8_t> data_{};
+};
+
+// Every way a storage buffer is consumed besides transfers.
+extern const vk::PipelineStageFlags kStorageStages;
+extern const vk::AccessFlags kStorageAccess;
+
+// Device local buffer read and written by shaders. Extra usage lets the
+// same buffer feed vertex fetch or indirect draws and dispatches.
+class StorageBuffer : public CommonBuffer {
+public:
+  StorageBuffer(Device* parent) : CommonBuffer(parent) {}
+
+  // Contents start zeroed when data is null.
+  bool SetData(const void* data, size_t size,
+               vk::BufferUsageFlags extra = vk::BufferUsageFlags());
+  size_t size() const { return size_; }
+  // Both wait for the GPU, ordered after every earlier shader access.
+  bool Upload(size_t offset, const void* data, size_t size);
+  bool Readback(size_t offset, void* data, size_t size) const;
 
 private:
   size_t size_ = 0;
+};
+
+// CPU copy of a uniform block laid out from reflection. Members are written
+// by name or by a handle looked up once, Flush uploads only the bytes that
+// changed since the last call.
+class UniformWriter {
+public:
+  using Handle = uint32_t;
+  static constexpr Handle kInvalidHandle = UINT32_MAX;
+
+  UniformWriter(UniformBuffer& buffer, const glsl::Uniform& block);
+
+  Handle GetHandle(const char* name) const;
+  // size may be smaller than the member, e.g. a vec3 in a 16 byte slot.
+  bool Set(Handle handle, const void* data, uint32_t size);
+  template <typename T> bool Set(Handle handle, const T& value) {
+    return Set(handle, &value, (uint32_t)sizeof(T));
+  }
+  template <typename T> bool Set(const char* name, const T& value) {
+    return Set(GetHandle(name), &value, (uint32_t)sizeof(T));
+  }
+  // Returns the number of bytes uploaded.
+  uint32_t Flush();
+
+private:
+  UniformBuffer& buffer_;
+  std::vector<glsl::BlockMember> members_{};
   std::vector<uint8_t> data_{};
+  // Sorted, non-overlapping [begin, end) byte ranges.
+  std::vector<std::pair<uint32_t, uint32_t>> dirty_{};
 };
 } // namespace impl
 } // namespace VPP
\ No newline at end of file
@@ -0,0 +1,449 @@
+#include "Compute.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+namespace VPP {
+
+namespace impl {
+
+ComputePipeline::ComputePipeline(Device* parent) : PipelineBase(parent) {}
+
+ComputePipeline::~ComputePipeline() {
+  Wait();
+  ReleaseShader();
+}
+
+void ComputePipeline::ReleaseShader() {
+  ReleaseShared(objects().pipelines, pipeline_);
+  ReleaseLayout();
+  Release(shader_);
+}
+
+bool ComputePipeline::SetShader(const glsl::MetaData& data) {
+  if (data.spvs.size() != 1 ||
+      data.spvs[0].stage != vk::ShaderStageFlagBits::eCompute) {
+    return false;
+  }
+  if (!CreateLayout(data)) {
+    return false;
+  }
+  SetSpecDefaults(data.specs);
+
+  const auto& spv = data.spvs[0].data;
+  auto hash = HashWords(spv.data(), spv.size());
+  shader_key_ = CacheKey();
+  shader_key_.Add((uint32_t)vk::ShaderStageFlagBits::eCompute);
+  shader_key_.Add((uint32_t)spv.size());
+  shader_key_.Add((uint32_t)hash);
+  shader_key_.Add((uint32_t)(hash >> 32));
+  shader_key_.AddHandle(pipe_layout_);
+
+  auto moduleCI = vk::ShaderModuleCreateInfo().setCode(spv);
+  shader_ = device().createShaderModule(moduleCI);
+  return !!shader_;
+}
+
+bool ComputePipeline::Reload(const glsl::MetaData& data) {
+  Wait();
+  auto entries = spec_entries_;
+  auto values = spec_data_;
+  ReleaseShader();
+  state_ = State::kIdle;
+  job_ = std::future<void>();
+  if (!SetShader(data)) {
+    return false;
+  }
+
+  for (const auto& e : entries) {
+    SetSpecConstant(e.constantID, values.data() + e.offset, (uint32_t)e.size);
+  }
+  return true;
+}
+
+bool ComputePipeline::SetSpecConstant(uint32_t id, const void* data,
+                                      uint32_t size) {
+  if (state_ != State::kIdle) {
+    return false;
+  }
+  return WriteSpecConstant(id, data, size);
+}
+
+bool ComputePipeline::Enable() {
+  if (!Compile()) {
+    return false;
+  }
+  Wait();
+  return ready();
+}
+
+bool ComputePipeline::Compile() {
+  auto state = state_.load();
+  if (state != State::kIdle) {
+    return state != State::kFailed;
+  }
+  if (!shader_) {
+    return false;
+  }
+
+  pipeline_key_ = shader_key_;
+  pipeline_key_.Add((uint32_t)spec_data_.size());
+  pipeline_key_.Add(spec_data_.data(), spec_data_.size());
+  pipeline_ = objects().pipelines.Acquire(pipeline_key_);
+  if (pipeline_) {
+    state_ = State::kReady;
+    return true;
+  }
+
+  state_ = State::kCompiling;
+  job_ = workers().Submit([this]() { Build(); });
+  return true;
+}
+
+void ComputePipeline::Wait() const {
+  if (job_.valid()) {
+    job_.wait();
+  }
+}
+
+void ComputePipeline::Build() {
+  auto stageInfo = vk::PipelineShaderStageCreateInfo()
+                       .setStage(vk::ShaderStageFlagBits::eCompute)
+                       .setModule(shader_)
+                       .setPName("main");
+  auto specInfo = vk::SpecializationInfo()
+                      .setMapEntries(spec_entries_)
+                      .setDataSize(spec_data_.size())
+                      .setPData(spec_data_.data());
+  if (!spec_entries_.empty()) {
+    stageInfo.setPSpecializationInfo(&specInfo);
+  }
+
+  auto pipelineCI =
+      vk::ComputePipelineCreateInfo().setStage(stageInfo).setLayout(
+          pipe_layout_);
+
+  vk::PipelineCreationFeedbackEXT feedback{};
+  auto feedbackCI = vk::PipelineCreationFeedbackCreateInfoEXT()
+                        .setPPipelineCreationFeedback(&feedback);
+  if (creation_feedback()) {
+    pipelineCI.setPNext(&feedbackCI);
+  }
+
+  auto& cache = pipeline_cache();
+  vk::Pipeline pipeline{};
+  auto result = device().createComputePipelines(cache.cache(), 1, &pipelineCI,
+                                                nullptr, &pipeline);
+  if (result != vk::Result::eSuccess) {
+    state_ = State::kFailed;
+    return;
+  }
+  if (creation_feedback()) {
+    cache.Record(feedback);
+  } else {
+    cache.RecordUnknown();
+  }
+
+  auto shared = objects().pipelines.InsertOrAcquire(pipeline_key_, pipeline);
+  if (shared != pipeline) {
+    device().destroy(pipeline);
+  }
+  pipeline_ = shared;
+  state_ = State::kReady;
+}
+
+void ComputePipeline::BindCmd(const vk::CommandBuffer& buf) const {
+  buf.bindPipeline(vk::PipelineBindPoint::eCompute, pipeline_);
+}
+
+DispatchParam::DispatchParam(Device* parent) : DeviceResource(parent) {}
+
+DispatchParam::~DispatchParam() { ReleaseSets(); }
+
+void DispatchParam::ReleaseSets() {
+  for (auto& e : descriptor_sets_) {
+    if (bindless() && e == bindless()->set()) {
+      continue;
+    }
+    Release(e);
+  }
+  descriptor_sets_.clear();
+}
+
+void DispatchParam::SetPipeline(ComputePipeline& pipeline) {
+  if (!pipeline.Compile()) {
+    return;
+  }
+  pipeline_ = &pipeline;
+
+  if (set_layouts_ == pipeline.desc_layout_) {
+    return;
+  }
+  ReleaseSets();
+  bindings_.clear();
+  set_layouts_ = pipeline.desc_layout_;
+
+  descriptor_sets_.resize(set_layouts_.size());
+  for (size_t i = 0; i < set_layouts_.size(); i++) {
+    if (bindless() && set_layouts_[i] == bindless()->layout()) {
+      descriptor_sets_[i] = bindless()->set();
+      continue;
+    }
+    if (!descriptors().Allocate(set_layouts_[i], descriptor_sets_[i])) {
+      std::cerr << "Fail to allocate descriptor set " << i << std::endl;
+    }
+  }
+}
+
+bool DispatchParam::SetPushConstant(uint32_t offset, const void* data,
+                                    uint32_t size) {
+  if (!pipeline_ || !data || !size || offset % 4 != 0 || size % 4 != 0) {
+    return false;
+  }
+
+  uint32_t limit = 0;
+  for (const auto& e : pipeline_->push_ranges_) {
+    limit = std::max(limit, e.offset + e.size);
+  }
+  if (offset + size > limit) {
+    return false;
+  }
+
+  if (push_data_.size() < offset + size) {
+    push_data_.resize(offset + size);
+  }
+  memcpy(push_data_.data() + offset, data, size);
+  return true;
+}
+
+bool DispatchParam::UpdateSet(uint32_t set, const DescriptorInfo* infos) {
+  if (!pipeline_ || !infos || set >= descriptor_sets_.size() ||
+      set >= pipeline_->update_templates_.size() ||
+      !pipeline_->update_templates_[set]) {
+    return false;
+  }
+  device().updateDescriptorSetWithTemplate(
+      descriptor_sets_[set], pipeline_->update_templates_[set], infos);
+  return true;
+}
+
+bool DispatchParam::BindStorageBuffer(uint32_t set, uint32_t binding,
+                                      const vk::Buffer& buffer,
+                                      vk::DeviceSize offset,
+                                      vk::DeviceSize range) {
+  auto bufferInfo = vk::DescriptorBufferInfo()
+                        .setBuffer(buffer)
+                        .setOffset(offset)
+                        .setRange(range);
+  return WriteDescriptor(set, binding, vk::DescriptorType::eStorageBuffer,
+                         &bufferInfo, nullptr);
+}
+
+bool DispatchParam::BindStorageImage(uint32_t set, uint32_t binding,
+                                     const vk::ImageView& view) {
+  auto imageInfo = vk::DescriptorImageInfo()
+                       .setImageView(view)
+                       .setImageLayout(vk::ImageLayout::eGeneral);
+  return WriteDescriptor(set, binding, vk::DescriptorType::eStorageImage,
+                         nullptr, &imageInfo);
+}
+
+bool DispatchParam::BindStorageBuffer(uint32_t set, uint32_t binding,
+                                      const StorageBuffer& buffer) {
+  if (!BindStorageBuffer(set, binding, buffer.buffer())) {
+    return false;
+  }
+  Binding bind{};
+  bind.set = set;
+  bind.binding = binding;
+  bind.buffer = &buffer;
+  bind.revision = buffer.revision();
+  AddBinding(bind);
+  return true;
+}
+
+bool DispatchParam::BindStorageImage(uint32_t set, uint32_t binding,
+                                     const StorageImage& image) {
+  if (!BindStorageImage(set, binding, image.view())) {
+    return false;
+  }
+  Binding bind{};
+  bind.set = set;
+  bind.binding = binding;
+  bind.image = &image;
+  bind.revision = image.revision();
+  AddBinding(bind);
+  return true;
+}
+
+void DispatchParam::AddBinding(const Binding& bind) {
+  auto iter = std::find_if(bindings_.begin(), bindings_.end(),
+                           [&bind](const Binding& e) {
+                             return e.set == bind.set &&
+                                    e.binding == bind.binding;
+                           });
+  if (iter == bindings_.end()) {
+    bindings_.push_back(bind);
+  } else {
+    *iter = bind;
+  }
+}
+
+void DispatchParam::RefreshBindings() const {
+  for (auto& e : bindings_) {
+    if (e.buffer && e.buffer->revision() != e.revision) {
+      auto bufferInfo = vk::DescriptorBufferInfo()
+                            .setBuffer(e.buffer->buffer())
+                            .setRange(VK_WHOLE_SIZE);
+      WriteDescriptor(e.set, e.binding, vk::DescriptorType::eStorageBuffer,
+                      &bufferInfo, nullptr);
+      e.revision = e.buffer->revision();
+    } else if (e.image && e.image->revision() != e.revision) {
+      auto imageInfo = vk::DescriptorImageInfo()
+                           .setImageView(e.image->view())
+                           .setImageLayout(vk::ImageLayout::eGeneral);
+      WriteDescriptor(e.set, e.binding, vk::DescriptorType::eStorageImage,
+                      nullptr, &imageInfo);
+      e.revision = e.image->revision();
+    }
+  }
+}
+
+bool DispatchParam::BindUniform(uint32_t set, uint32_t binding,
+                                const vk::Buffer& buffer,
+                                vk::DeviceSize offset, vk::DeviceSize range) {
+  auto bufferInfo = vk::DescriptorBufferInfo()
+                        .setBuffer(buffer)
+                        .setOffset(offset)
+                        .setRange(range);
+  return WriteDescriptor(set, binding, vk::DescriptorType::eUniformBuffer,
+                         &bufferInfo, nullptr);
+}
+
+bool DispatchParam::WriteDescriptor(
+    uint32_t set, uint32_t binding, vk::DescriptorType type,
+    const vk::DescriptorBufferInfo* buffer,
+    const vk::DescriptorImageInfo* image) const {
+  if (set >= descriptor_sets_.size() || !descriptor_sets_[set]) {
+    return false;
+  }
+  auto write = vk::WriteDescriptorSet()
+                   .setDescriptorCount(1)
+                   .setDescriptorType(type)
+                   .setDstSet(descriptor_sets_[set])
+                   .setDstBinding(binding)
+                   .setPBufferInfo(buffer)
+                   .setPImageInfo(image);
+  device().updateDescriptorSets(1, &write, 0, nullptr);
+  return true;
+}
+
+void DispatchParam::BindCmd(const vk::CommandBuffer& buf) const {
+  RefreshBindings();
+  pipeline_->BindCmd(buf);
+  if (!descriptor_sets_.empty()) {
+    std::vector<uint32_t> offset{};
+    buf.bindDescriptorSets(vk::PipelineBindPoint::eCompute,
+                           pipeline_->pipe_layout_, 0, descriptor_sets_,
+                           offset);
+  }
+  for (const auto& e : pipeline_->push_spans_) {
+    if (e.offset >= push_data_.size()) {
+      continue;
+    }
+    auto size =
+        std::min<uint32_t>(e.size, (uint32_t)push_data_.size() - e.offset);
+    buf.pushConstants(pipeline_->pipe_layout_, e.stageFlags, e.offset, size,
+                      push_data_.data() + e.offset);
+  }
+}
+
+bool DispatchParam::DispatchCmd(const vk::CommandBuffer& buf, uint32_t x,
+                                uint32_t y, uint32_t z) const {
+  if (!ready() || !buf) {
+    return false;
+  }
+  BindCmd(buf);
+  buf.dispatch(x, y, z);
+  return true;
+}
+
+bool DispatchParam::DispatchIndirectCmd(const vk::CommandBuffer& buf,
+                                        const vk::Buffer& args,
+                                        vk::DeviceSize offset) const {
+  if (!ready() || !buf || !args) {
+    return false;
+  }
+  BindCmd(buf);
+  buf.dispatchIndirect(args, offset);
+  return true;
+}
+
+// Makes shader writes visible to the host and to whatever runs next.
+static void AddHostBarrier(const vk::CommandBuffer& cmd) {
+  auto barrier =
+      vk::MemoryBarrier()
+          .setSrcAccessMask(vk::AccessFlagBits::eShaderWrite)
+          .setDstAccessMask(vk::AccessFlagBits::eHostRead |
+                            vk::AccessFlagBits::eMemoryRead);
+  cmd.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader,
+                      vk::PipelineStageFlagBits::eHost |
+                          vk::PipelineStageFlagBits::eAllCommands,
+                      (vk::DependencyFlagBits)0, 1, &barrier, 0, nullptr, 0,
+                      nullptr);
+}
+
+bool DispatchParam::Dispatch(uint32_t x, uint32_t y, uint32_t z) const {
+  if (!pipeline_) {
+    return false;
+  }
+  pipeline_->Wait();
+  auto cmd = BeginOnceCmd();
+  if (!cmd) {
+    return false;
+  }
+  bool recorded = DispatchCmd(cmd, x, y, z);
+  AddHostBarrier(cmd);
+  EndOnceCmd(cmd);
+  return recorded;
+}
+
+bool DispatchParam::DispatchIndirect(const vk::Buffer& args,
+                                     vk::DeviceSize offset) const {
+  if (!pipeline_) {
+    return false;
+  }
+  pipeline_->Wait();
+  auto cmd = BeginOnceCmd();
+  if (!cmd) {
+    return false;
+  }
+  bool recorded = DispatchIndirectCmd(cmd, args, offset);
+  AddHostBarrier(cmd);
+  EndOnceCmd(cmd);
+  return recorded;
+}
+
+void RecordComputeBarrier(const vk::CommandBuffer& buf) {
+  auto barrier =
+      vk::MemoryBarrier()
+          .setSrcAccessMask(vk::AccessFlagBits::eShaderWrite)
+          .setDstAccessMask(vk::AccessFlagBits::eShaderRead |
+                            vk::AccessFlagBits::eShaderWrite |
+                            vk::AccessFlagBits::eUniformRead |
+                            vk::AccessFlagBits::eIndirectCommandRead |
+                            vk::AccessFlagBits::eVertexAttributeRead |
+                            vk::AccessFlagBits::eIndexRead);
+  buf.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader,
+                      vk::PipelineStageFlagBits::eComputeShader |
+                          vk::PipelineStageFlagBits::eDrawIndirect |
+                          vk::PipelineStageFlagBits::eVertexInput |
+                          vk::PipelineStageFlagBits::eVertexShader |
+                          vk::PipelineStageFlagBits::eFragmentShader,
+                      (vk::DependencyFlagBits)0, 1, &barrier, 0, nullptr, 0,
+                      nullptr);
+}
+
+} // namespace impl
+} // namespace VPP
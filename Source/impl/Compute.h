@@ -0,0 +1,146 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include <atomic>
+#include <future>
+
+#include "Buffer.h"
+#include "Device.h"
+#include "Image.h"
+#include "Pipeline.h"
+#include "ShaderData.h"
+
+namespace VPP {
+
+namespace impl {
+
+class ComputePipeline : public PipelineBase {
+  friend class DispatchParam;
+
+public:
+  ComputePipeline(Device* parent);
+  ~ComputePipeline();
+
+  // data must hold a single compute stage.
+  bool SetShader(const glsl::MetaData& data);
+  // Replaces the shader keeping spec constant overrides, the pipeline is
+  // idle again afterwards.
+  bool Reload(const glsl::MetaData& data);
+  // Overrides a reflected constant_id, only before compiling.
+  bool SetSpecConstant(uint32_t id, const void* data, uint32_t size);
+  template <typename T> bool SetSpecConstant(uint32_t id, const T& value) {
+    return SetSpecConstant(id, &value, (uint32_t)sizeof(T));
+  }
+  bool SetSpecConstant(uint32_t id, bool value) {
+    VkBool32 data = value ? VK_TRUE : VK_FALSE;
+    return SetSpecConstant(id, &data, (uint32_t)sizeof(data));
+  }
+  // Compiles on the calling thread, returns once the pipeline is usable.
+  bool Enable();
+  // Starts compiling on the device's workers, false if it cannot be built.
+  bool Compile();
+  void Wait() const;
+  bool ready() const { return state_ == State::kReady; }
+  bool failed() const { return state_ == State::kFailed; }
+
+  void BindCmd(const vk::CommandBuffer& buf) const;
+
+private:
+  enum class State { kIdle, kCompiling, kReady, kFailed };
+
+  void ReleaseShader();
+  void Build();
+
+  vk::Pipeline pipeline_{};
+  vk::ShaderModule shader_{};
+  // Stage, SPIR-V hash and layout, the start of the pipeline's cache key.
+  CacheKey shader_key_{};
+  CacheKey pipeline_key_{};
+  std::atomic<State> state_{State::kIdle};
+  std::future<void> job_{};
+};
+
+// Descriptor sets and push constants of one compute pipeline. Dispatches
+// are recorded into a caller's command buffer, added to the frame through
+// DrawParam::AddDispatch, or submitted standalone.
+class DispatchParam : public DeviceResource {
+public:
+  DispatchParam(Device* parent);
+  ~DispatchParam();
+
+  // Starts compiling the pipeline, sets are kept across pipelines sharing
+  // the same layouts.
+  void SetPipeline(ComputePipeline& pipeline);
+  bool ready() const { return pipeline_ && pipeline_->ready(); }
+
+  bool SetPushConstant(uint32_t offset, const void* data, uint32_t size);
+  template <typename T>
+  bool SetPushConstant(const T& value, uint32_t offset = 0) {
+    return SetPushConstant(offset, &value, (uint32_t)sizeof(T));
+  }
+
+  // Writes a whole set in one call, infos holds
+  // ComputePipeline::GetDescriptorCount(set) entries in binding order.
+  bool UpdateSet(uint32_t set, const DescriptorInfo* infos);
+  bool BindStorageBuffer(uint32_t set, uint32_t binding,
+                         const vk::Buffer& buffer, vk::DeviceSize offset = 0,
+                         vk::DeviceSize range = VK_WHOLE_SIZE);
+  // The image must be in eGeneral layout when the dispatch runs.
+  bool BindStorageImage(uint32_t set, uint32_t binding,
+                        const vk::ImageView& view);
+  // Rewritten before the next dispatch whenever the resource is recreated
+  // or relocated.
+  bool BindStorageBuffer(uint32_t set, uint32_t binding,
+                         const StorageBuffer& buffer);
+  bool BindStorageImage(uint32_t set, uint32_t binding,
+                        const StorageImage& image);
+  bool BindUniform(uint32_t set, uint32_t binding, const vk::Buffer& buffer,
+                   vk::DeviceSize offset = 0,
+                   vk::DeviceSize range = VK_WHOLE_SIZE);
+
+  // Record into buf outside a render pass, false while the pipeline is not
+  // ready. Follow with RecordComputeBarrier before consuming the results.
+  bool DispatchCmd(const vk::CommandBuffer& buf, uint32_t x, uint32_t y,
+                   uint32_t z) const;
+  // args holds a VkDispatchIndirectCommand at offset.
+  bool DispatchIndirectCmd(const vk::CommandBuffer& buf, const vk::Buffer& args,
+                           vk::DeviceSize offset) const;
+
+  // Standalone, waits for the pipeline, submits and blocks until the GPU is
+  // done. Results are visible to the host and to later submissions.
+  bool Dispatch(uint32_t x, uint32_t y = 1, uint32_t z = 1) const;
+  bool DispatchIndirect(const vk::Buffer& args,
+                        vk::DeviceSize offset = 0) const;
+
+private:
+  struct Binding {
+    uint32_t set = 0;
+    uint32_t binding = 0;
+    const StorageBuffer* buffer = nullptr;
+    const StorageImage* image = nullptr;
+    uint32_t revision = 0;
+  };
+
+  void BindCmd(const vk::CommandBuffer& buf) const;
+  void AddBinding(const Binding& bind);
+  void RefreshBindings() const;
+  bool WriteDescriptor(uint32_t set, uint32_t binding, vk::DescriptorType type,
+                       const vk::DescriptorBufferInfo* buffer,
+                       const vk::DescriptorImageInfo* image) const;
+  void ReleaseSets();
+
+  const ComputePipeline* pipeline_ = nullptr;
+  std::vector<vk::DescriptorSetLayout> set_layouts_{};
+  std::vector<vk::DescriptorSet> descriptor_sets_{};
+  std::vector<uint8_t> push_data_{};
+  mutable std::vector<Binding> bindings_{};
+};
+
+// Makes compute shader writes visible to later dispatches, indirect
+// arguments, vertex fetch and shader reads of draws.
+void RecordComputeBarrier(const vk::CommandBuffer& buf);
+
+} // namespace impl
+
+} // namespace VPP
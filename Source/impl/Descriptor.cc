@@ -0,0 +1,235 @@
+#include "Descriptor.h"
+
+#include <algorithm>
+
+namespace VPP {
+namespace impl {
+
+static const uint32_t kInitialSets = 64;
+static const uint32_t kMaxSets = 4096;
+
+// Descriptors reserved per set for each type.
+static const std::pair<vk::DescriptorType, float> kPoolRatios[] = {
+    {vk::DescriptorType::eSampler, 0.5f},
+    {vk::DescriptorType::eCombinedImageSampler, 4.f},
+    {vk::DescriptorType::eSampledImage, 4.f},
+    {vk::DescriptorType::eStorageImage, 1.f},
+    {vk::DescriptorType::eUniformTexelBuffer, 1.f},
+    {vk::DescriptorType::eStorageTexelBuffer, 1.f},
+    {vk::DescriptorType::eUniformBuffer, 2.f},
+    {vk::DescriptorType::eStorageBuffer, 2.f},
+    {vk::DescriptorType::eUniformBufferDynamic, 1.f},
+    {vk::DescriptorType::eStorageBufferDynamic, 1.f},
+    {vk::DescriptorType::eInputAttachment, 0.5f},
+};
+
+DescriptorAllocator::DescriptorAllocator(const vk::Device& device,
+                                         bool freeable)
+    : device_(device), freeable_(freeable), next_sets_(kInitialSets) {}
+
+DescriptorAllocator::~DescriptorAllocator() {
+  for (auto& e : used_pools_) {
+    device_.destroy(e);
+  }
+  for (auto& e : free_pools_) {
+    device_.destroy(e);
+  }
+}
+
+vk::DescriptorPool DescriptorAllocator::CreatePool(uint32_t maxSets) {
+  std::vector<vk::DescriptorPoolSize> poolSizes{};
+  for (const auto& e : kPoolRatios) {
+    poolSizes.emplace_back(vk::DescriptorPoolSize().setType(e.first).setDescriptorCount(
+        std::max(1u, (uint32_t)(e.second * maxSets))));
+  }
+
+  auto poolCI = vk::DescriptorPoolCreateInfo()
+                    .setMaxSets(maxSets)
+                    .setPoolSizes(poolSizes);
+  if (freeable_) {
+    poolCI.setFlags(vk::DescriptorPoolCreateFlagBits::eFreeDescriptorSet);
+  }
+
+  vk::DescriptorPool pool{};
+  if (device_.createDescriptorPool(&poolCI, nullptr, &pool) !=
+      vk::Result::eSuccess) {
+    return vk::DescriptorPool();
+  }
+  return pool;
+}
+
+vk::DescriptorPool DescriptorAllocator::GetPool() {
+  if (!free_pools_.empty()) {
+    auto pool = free_pools_.back();
+    free_pools_.pop_back();
+    return pool;
+  }
+
+  auto pool = CreatePool(next_sets_);
+  next_sets_ = std::min(next_sets_ * 2, kMaxSets);
+  return pool;
+}
+
+bool DescriptorAllocator::Allocate(const vk::DescriptorSetLayout& layout,
+                                   vk::DescriptorSet& set) {
+  for (int attempt = 0; attempt < 2; attempt++) {
+    if (!current_) {
+      current_ = GetPool();
+      if (!current_) {
+        return false;
+      }
+      used_pools_.push_back(current_);
+    }
+
+    auto descAI = vk::DescriptorSetAllocateInfo()
+                      .setDescriptorPool(current_)
+                      .setDescriptorSetCount(1)
+                      .setPSetLayouts(&layout);
+    auto result = device_.allocateDescriptorSets(&descAI, &set);
+    if (result == vk::Result::eSuccess) {
+      if (freeable_) {
+        owners_[static_cast<VkDescriptorSet>(set)] = current_;
+      }
+      return true;
+    }
+    if (result != vk::Result::eErrorOutOfPoolMemory &&
+        result != vk::Result::eErrorFragmentedPool) {
+      return false;
+    }
+    current_ = vk::DescriptorPool();
+  }
+
+  return false;
+}
+
+void DescriptorAllocator::Free(const vk::DescriptorSet& set) {
+  auto iter = owners_.find(static_cast<VkDescriptorSet>(set));
+  if (iter == owners_.end()) {
+    return;
+  }
+  device_.freeDescriptorSets(iter->second, 1, &set);
+  owners_.erase(iter);
+}
+
+void DescriptorAllocator::Reset() {
+  for (auto& e : used_pools_) {
+    device_.resetDescriptorPool(e);
+    free_pools_.push_back(e);
+  }
+  used_pools_.clear();
+  owners_.clear();
+  current_ = vk::DescriptorPool();
+}
+
+BindlessTable::BindlessTable(const vk::Device& device, uint32_t capacity)
+    : device_(device), capacity_(capacity) {
+  auto bindingFlags = vk::DescriptorBindingFlags(
+      vk::DescriptorBindingFlagBits::ePartiallyBound |
+      vk::DescriptorBindingFlagBits::eUpdateAfterBind);
+  auto flagsCI = vk::DescriptorSetLayoutBindingFlagsCreateInfo()
+                     .setBindingCount(1)
+                     .setPBindingFlags(&bindingFlags);
+  auto binding =
+      vk::DescriptorSetLayoutBinding()
+          .setBinding(0)
+          .setDescriptorType(vk::DescriptorType::eCombinedImageSampler)
+          .setDescriptorCount(capacity_)
+          .setStageFlags(vk::ShaderStageFlagBits::eAll);
+  auto layoutCI =
+      vk::DescriptorSetLayoutCreateInfo()
+          .setFlags(
+              vk::DescriptorSetLayoutCreateFlagBits::eUpdateAfterBindPool)
+          .setBindingCount(1)
+          .setPBindings(&binding)
+          .setPNext(&flagsCI);
+  if (device_.createDescriptorSetLayout(&layoutCI, nullptr, &layout_) !=
+      vk::Result::eSuccess) {
+    return;
+  }
+
+  auto poolSize = vk::DescriptorPoolSize()
+                      .setType(vk::DescriptorType::eCombinedImageSampler)
+                      .setDescriptorCount(capacity_);
+  auto poolCI =
+      vk::DescriptorPoolCreateInfo()
+          .setFlags(vk::DescriptorPoolCreateFlagBits::eUpdateAfterBind)
+          .setMaxSets(1)
+          .setPoolSizeCount(1)
+          .setPPoolSizes(&poolSize);
+  if (device_.createDescriptorPool(&poolCI, nullptr, &pool_) !=
+      vk::Result::eSuccess) {
+    return;
+  }
+
+  auto descAI = vk::DescriptorSetAllocateInfo()
+                    .setDescriptorPool(pool_)
+                    .setDescriptorSetCount(1)
+                    .setPSetLayouts(&layout_);
+  if (device_.allocateDescriptorSets(&descAI, &set_) != vk::Result::eSuccess) {
+    set_ = vk::DescriptorSet();
+  }
+}
+
+BindlessTable::~BindlessTable() {
+  if (pool_) {
+    device_.destroy(pool_);
+  }
+  if (layout_) {
+    device_.destroy(layout_);
+  }
+}
+
+uint32_t BindlessTable::Acquire() {
+  if (!free_indices_.empty()) {
+    auto index = free_indices_.back();
+    free_indices_.pop_back();
+    return index;
+  }
+  if (next_index_ >= capacity_) {
+    return UINT32_MAX;
+  }
+  return next_index_++;
+}
+
+void BindlessTable::Free(uint32_t index) {
+  if (index >= capacity_) {
+    return;
+  }
+  pending_.erase(index);
+  free_indices_.push_back(index);
+}
+
+void BindlessTable::Write(uint32_t index, const vk::ImageView& view,
+                          const vk::Sampler& sampler) {
+  if (index >= capacity_) {
+    return;
+  }
+  pending_[index] = vk::DescriptorImageInfo()
+                        .setImageView(view)
+                        .setSampler(sampler)
+                        .setImageLayout(vk::ImageLayout::eShaderReadOnlyOptimal);
+}
+
+void BindlessTable::Flush() {
+  if (!set_ || pending_.empty()) {
+    return;
+  }
+
+  std::vector<vk::WriteDescriptorSet> writes{};
+  writes.reserve(pending_.size());
+  for (const auto& e : pending_) {
+    writes.emplace_back(
+        vk::WriteDescriptorSet()
+            .setDstSet(set_)
+            .setDstBinding(0)
+            .setDstArrayElement(e.first)
+            .setDescriptorCount(1)
+            .setDescriptorType(vk::DescriptorType::eCombinedImageSampler)
+            .setPImageInfo(&e.second));
+  }
+  device_.updateDescriptorSets(writes, nullptr);
+  pending_.clear();
+}
+
+} // namespace impl
+} // namespace VPP
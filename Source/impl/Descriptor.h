@@ -0,0 +1,79 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include <map>
+#include <vector>
+
+namespace VPP {
+namespace impl {
+
+// One element of the packed array consumed by descriptor update templates.
+union DescriptorInfo {
+  vk::DescriptorImageInfo image;
+  vk::DescriptorBufferInfo buffer;
+  vk::BufferView texel;
+
+  DescriptorInfo() : buffer() {}
+};
+
+// Hands out descriptor sets from a chain of pools, adding a larger pool
+// whenever the current one runs out.
+class DescriptorAllocator {
+public:
+  DescriptorAllocator(const vk::Device& device, bool freeable);
+  ~DescriptorAllocator();
+
+  bool Allocate(const vk::DescriptorSetLayout& layout, vk::DescriptorSet& set);
+  // Only valid for allocators created as freeable.
+  void Free(const vk::DescriptorSet& set);
+  // Returns every set at once, pools are kept for the next round.
+  void Reset();
+
+private:
+  vk::DescriptorPool GetPool();
+  vk::DescriptorPool CreatePool(uint32_t maxSets);
+
+  vk::Device device_{};
+  bool freeable_ = false;
+  uint32_t next_sets_ = 0;
+  vk::DescriptorPool current_{};
+  std::vector<vk::DescriptorPool> used_pools_{};
+  std::vector<vk::DescriptorPool> free_pools_{};
+  std::map<VkDescriptorSet, vk::DescriptorPool> owners_{};
+};
+
+// One update-after-bind array of combined image samplers shared by every
+// pipeline that opts into bindless texturing. Textures keep their index
+// for their whole lifetime and shaders select them by that index.
+class BindlessTable {
+public:
+  BindlessTable(const vk::Device& device, uint32_t capacity);
+  ~BindlessTable();
+
+  explicit operator bool() const { return set_; }
+  const vk::DescriptorSetLayout& layout() const { return layout_; }
+  const vk::DescriptorSet& set() const { return set_; }
+  uint32_t capacity() const { return capacity_; }
+
+  // Returns UINT32_MAX once the table is full.
+  uint32_t Acquire();
+  void Free(uint32_t index);
+  // Writes are queued until Flush, the set may be in use by the GPU.
+  void Write(uint32_t index, const vk::ImageView& view,
+             const vk::Sampler& sampler);
+  void Flush();
+
+private:
+  vk::Device device_{};
+  uint32_t capacity_ = 0;
+  vk::DescriptorPool pool_{};
+  vk::DescriptorSetLayout layout_{};
+  vk::DescriptorSet set_{};
+  uint32_t next_index_ = 0;
+  std::vector<uint32_t> free_indices_{};
+  std::map<uint32_t, vk::DescriptorImageInfo> pending_{};
+};
+
+} // namespace impl
+} // namespace VPP
@@ -2,9 +2,14 @@
 
 #include <SDL2/SDL_vulkan.h>
 
+#include <algorithm>
+#include <cstring>
+#include <fstream>
 #include <iostream>
 #include <set>
+#include <sstream>
 
+#include "Buffer.h"
 #include "DrawCmd.h"
 #include "VPP_Config.h"
 
@@ -55,14 +60,27 @@ Device::Device(Window* window) {
   CreateSurface(window->window());
   SetGpuAndIndices();
   CreateDevice();
+  allocator_ = std::make_unique<MemoryAllocator>(device_);
+  descriptors_ = std::make_unique<DescriptorAllocator>(device_, true);
+  for (int i = 0; i < FRAME_LAG; i++) {
+    frame_descriptors_.emplace_back(
+        std::make_unique<DescriptorAllocator>(device_, false));
+  }
+  CreateBindlessTable();
+  pipeline_cache_ =
+      std::make_unique<PipelineCache>(device_, property_, PIPELINE_CACHE_FILE);
+  workers_ = std::make_unique<ThreadPool>();
   GetQueues();
   CreateSwapchainResource(VK_NULL_HANDLE);
   CreateSyncObject();
 }
 
 Device::~Device() {
+  workers_.reset();
   device_.waitIdle();
   if (device_) {
+    deletion_queue_.Flush();
+
     if (swapchain_) {
       device_.destroy(swapchain_);
     }
@@ -74,6 +92,12 @@ Device::~Device() {
       device_.destroy(render_complete_[i]);
     }
 
+    pipeline_cache_->Save();
+    pipeline_cache_.reset();
+    bindless_.reset();
+    frame_descriptors_.clear();
+    descriptors_.reset();
+    allocator_.reset();
     device_.destroy();
   }
   if (instance_) {
@@ -103,8 +127,110 @@ bool Device::FindMemoryType(uint32_t memType, vk::MemoryPropertyFlags mask,
   return false;
 }
 
+void Device::Retire(std::function<void()>&& deleter) {
+  // Commands recorded for the next submission may still reference it.
+  deletion_queue_.Push(submit_serial_ + 1, std::move(deleter));
+}
+
+void Device::CollectGarbage(uint64_t completed) {
+  complete_serial_ = std::max(complete_serial_, completed);
+  deletion_queue_.Collect(complete_serial_);
+  allocator_->ReleaseEmptyBlocks();
+}
+
+bool Device::Defragment() {
+  if (!defrag_budget_ || !defrag_command_) {
+    return false;
+  }
+
+  auto beginInfo = vk::CommandBufferBeginInfo().setFlags(
+      vk::CommandBufferUsageFlagBits::eOneTimeSubmit);
+  defrag_command_.begin(beginInfo);
+  auto moved = allocator_->Defragment(defrag_command_, defrag_budget_);
+  if (moved) {
+    // Moved storage buffers may be read and written by dispatches and
+    // indirect commands later in the frame.
+    auto barrier = vk::MemoryBarrier()
+                       .setSrcAccessMask(vk::AccessFlagBits::eTransferWrite)
+                       .setDstAccessMask(kStorageAccess);
+    defrag_command_.pipelineBarrier(
+        vk::PipelineStageFlagBits::eTransfer, kStorageStages,
+        (vk::DependencyFlagBits)0, 1, &barrier, 0, nullptr, 0, nullptr);
+  }
+  defrag_command_.end();
+  return moved != 0;
+}
+
+MemoryStats Device::GetMemoryStats() const {
+  auto stats = allocator_->stats();
+  auto props = gpu_.getMemoryProperties();
+  for (uint32_t i = 0; i < props.memoryTypeCount; i++) {
+    const auto& type = stats.types[i];
+    auto& heap = stats.heaps[props.memoryTypes[i].heapIndex];
+    heap.reserved += type.reserved;
+    heap.used += type.used;
+    heap.blocks += type.blocks;
+  }
+  return stats;
+}
+
+std::string Device::DumpMemoryStats() const {
+  auto stats = GetMemoryStats();
+  auto props = gpu_.getMemoryProperties();
+
+  std::ostringstream out{};
+  out << "{\n  \"reserved\": " << stats.reserved << ",\n  \"used\": "
+      << stats.used << ",\n  \"peak_reserved\": " << stats.peak_reserved
+      << ",\n  \"peak_used\": " << stats.peak_used
+      << ",\n  \"total_allocs\": " << stats.total_allocs
+      << ",\n  \"total_relocations\": " << stats.total_relocations
+      << ",\n  \"frame_allocs\": " << stats.frame_allocs
+      << ",\n  \"frame_bytes\": " << stats.frame_bytes;
+
+  out << ",\n  \"heaps\": [";
+  for (uint32_t i = 0; i < props.memoryHeapCount; i++) {
+    const auto& heap = stats.heaps[i];
+    out << (i ? "," : "") << "\n    {\"index\": " << i
+        << ", \"size\": " << props.memoryHeaps[i].size
+        << ", \"flags\": " << (uint32_t)props.memoryHeaps[i].flags
+        << ", \"blocks\": " << heap.blocks
+        << ", \"reserved\": " << heap.reserved << ", \"used\": " << heap.used
+        << "}";
+  }
+  out << "\n  ],\n  \"types\": [";
+  for (uint32_t i = 0; i < props.memoryTypeCount; i++) {
+    const auto& type = stats.types[i];
+    out << (i ? "," : "") << "\n    {\"index\": " << i
+        << ", \"heap\": " << props.memoryTypes[i].heapIndex
+        << ", \"flags\": " << (uint32_t)props.memoryTypes[i].propertyFlags
+        << ", \"blocks\": " << type.blocks
+        << ", \"reserved\": " << type.reserved << ", \"used\": " << type.used
+        << "}";
+  }
+  out << "\n  ],\n  \"classes\": {";
+  for (size_t i = 0; i < (size_t)MemoryClass::kCount; i++) {
+    const auto& cls = stats.classes[i];
+    out << (i ? "," : "") << "\n    \"" << GetClassName((MemoryClass)i)
+        << "\": {\"count\": " << cls.count << ", \"bytes\": " << cls.bytes
+        << "}";
+  }
+  out << "\n  }\n}\n";
+  return out.str();
+}
+
+bool Device::DumpMemoryStats(const char* fn) const {
+  std::ofstream file(fn);
+  if (!file) {
+    std::cerr << "Fail to open file: " << fn << std::endl;
+    return false;
+  }
+  file << DumpMemoryStats();
+  return true;
+}
+
 void Device::ReCreateSwapchain() {
   device_.waitIdle();
+  CollectGarbage(submit_serial_);
 
   for (int i = 0; i < FRAME_LAG; i++) {
     device_.waitForFences(1, &fences_[i], VK_TRUE, UINT64_MAX);
@@ -129,6 +255,13 @@ void Device::set_cmd(const DrawParam& cmd) {
 void Device::Draw() {
   device_.waitForFences(1, &fences_[0], VK_TRUE, UINT64_MAX);
   device_.resetFences(1, &fences_[0]);
+  // Nothing submitted is running now, queued bindless writes are safe and
+  // must land before the views they replace are collected.
+  if (bindless_) {
+    bindless_->Flush();
+  }
+  CollectGarbage(fence_serials_[0]);
+  frame_descriptors_[frame_index_]->Reset();
 
   auto& curBuf = current_buffer_;
 
@@ -147,7 +280,14 @@ void Device::Draw() {
     }
   } while (result != vk::Result::eSuccess);
 
+  vk::CommandBuffer submitCmds[2] = {};
+  uint32_t submitCount = 0;
+  if (Defragment()) {
+    submitCmds[submitCount++] = defrag_command_;
+  }
+
   cmd_->Call(commands_[0], framebuffers_[curBuf], render_pass_);
+  submitCmds[submitCount++] = commands_[0];
 
   vk::PipelineStageFlags pipeStageFlags =
       vk::PipelineStageFlagBits::eColorAttachmentOutput;
@@ -156,13 +296,15 @@ void Device::Draw() {
           .setPWaitDstStageMask(&pipeStageFlags)
           .setWaitSemaphoreCount(1)
           .setPWaitSemaphores(&image_acquired_[frame_index_])
-          .setCommandBufferCount(1)
-          .setPCommandBuffers(&commands_[0])
+          .setCommandBufferCount(submitCount)
+          .setPCommandBuffers(submitCmds)
           .setSignalSemaphoreCount(1)
           .setPSignalSemaphores(&render_complete_[frame_index_]);
 
   result = graphics_queue_.submit(1, &submitInfo, fences_[0]);
   assert(result == vk::Result::eSuccess);
+  fence_serials_[0] = ++submit_serial_;
+  allocator_->EndFrame();
 
   auto const presentInfo =
       vk::PresentInfoKHR()
@@ -187,6 +329,7 @@ void Device::Draw() {
 
 void Device::EndDraw() {
   device_.waitIdle();
+  CollectGarbage(submit_serial_);
 
   for (int i = 0; i < FRAME_LAG; i++) {
     device_.waitForFences(1, &fences_[i], VK_TRUE, UINT64_MAX);
@@ -198,6 +341,7 @@ void Device::EndDraw() {
   fences_.reset();
   image_acquired_.reset();
   render_complete_.reset();
+  fence_serials_.reset();
 }
 
 void Device::CreateSwapchainResource(vk::SwapchainKHR oldSwapchain) {
@@ -271,7 +415,8 @@ void Device::DestroySwapchainResource() {
   }
 
   if (depth_memory_) {
-    device_.free(depth_memory_);
+    allocator_->Free(depth_memory_);
+    depth_memory_ = Allocation();
   }
 }
 
@@ -339,18 +484,19 @@ void Device::CreateDepthbuffer(vk::Extent2D extent) {
   result = device_.createImage(&imageCI, nullptr, &depth_image_);
   assert(result == vk::Result::eSuccess);
 
-  vk::MemoryAllocateInfo memoryAI;
+  uint32_t typeIndex = 0;
   vk::MemoryRequirements memReq;
   device_.getImageMemoryRequirements(depth_image_, &memReq);
-  memoryAI.setAllocationSize(memReq.size);
   auto pass = FindMemoryType(memReq.memoryTypeBits,
                              vk::MemoryPropertyFlagBits::eDeviceLocal,
-                             memoryAI.memoryTypeIndex);
+                             typeIndex);
   assert(pass);
-  result = device_.allocateMemory(&memoryAI, nullptr, &depth_memory_);
-  assert(result == vk::Result::eSuccess);
+  depth_memory_ = allocator_->Allocate(memReq, typeIndex, MemoryClass::kDepth,
+                                       true, nullptr);
+  assert(depth_memory_);
 
-  device_.bindImageMemory(depth_image_, depth_memory_, 0);
+  device_.bindImageMemory(depth_image_, depth_memory_.memory(),
+                          depth_memory_.offset);
   auto imageViewCI = vk::ImageViewCreateInfo()
                          .setImage(depth_image_)
                          .setViewType(vk::ImageViewType::e2D)
@@ -453,6 +599,9 @@ void Device::CreateCommandBuffers() {
     result = device_.allocateCommandBuffers(&cmdAI, &commands_[i]);
     assert(result == vk::Result::eSuccess);
   }
+
+  result = device_.allocateCommandBuffers(&cmdAI, &defrag_command_);
+  assert(result == vk::Result::eSuccess);
 }
 
 void Device::CreateInstance(SDL_Window* window) {
@@ -555,16 +704,124 @@ void Device::CreateDevice() {
 
   std::vector<const char*> enabledExtensions{VK_KHR_SWAPCHAIN_EXTENSION_NAME};
 
+  // Bindless texturing needs a runtime sized, partially bound sampler array
+  // that can be updated while bound.
+  auto supported =
+      gpu_.getFeatures2<vk::PhysicalDeviceFeatures2,
+                        vk::PhysicalDeviceDescriptorIndexingFeaturesEXT,
+                        vk::PhysicalDeviceExtendedDynamicStateFeaturesEXT,
+                        vk::PhysicalDeviceGraphicsPipelineLibraryFeaturesEXT>();
+  const auto& indexing =
+      supported.get<vk::PhysicalDeviceDescriptorIndexingFeaturesEXT>();
+  auto indexingFeatures =
+      vk::PhysicalDeviceDescriptorIndexingFeaturesEXT()
+          .setShaderSampledImageArrayNonUniformIndexing(VK_TRUE)
+          .setDescriptorBindingSampledImageUpdateAfterBind(VK_TRUE)
+          .setDescriptorBindingPartiallyBound(VK_TRUE)
+          .setRuntimeDescriptorArray(VK_TRUE);
+  descriptor_indexing_ =
+      indexing.shaderSampledImageArrayNonUniformIndexing &&
+      indexing.descriptorBindingSampledImageUpdateAfterBind &&
+      indexing.descriptorBindingPartiallyBound &&
+      indexing.runtimeDescriptorArray;
+  // Cull mode, front face, topology and depth state become dynamic.
+  auto dynamicStateFeatures =
+      vk::PhysicalDeviceExtendedDynamicStateFeaturesEXT().setExtendedDynamicState(
+          VK_TRUE);
+  extended_dynamic_state_ =
+      supported.get<vk::PhysicalDeviceExtendedDynamicStateFeaturesEXT>()
+          .extendedDynamicState;
+
+  // Pipelines are linked from separately compiled parts.
+  auto libraryFeatures =
+      vk::PhysicalDeviceGraphicsPipelineLibraryFeaturesEXT()
+          .setGraphicsPipelineLibrary(VK_TRUE);
+  pipeline_library_ =
+      supported.get<vk::PhysicalDeviceGraphicsPipelineLibraryFeaturesEXT>()
+          .graphicsPipelineLibrary;
+
+  bool indexingExtension = false;
+  bool dynamicStateExtension = false;
+  bool libraryExtensions[2] = {false, false};
+  for (const auto& e : gpu_.enumerateDeviceExtensionProperties()) {
+    if (strcmp(e.extensionName, VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME) ==
+        0) {
+      indexingExtension = true;
+    } else if (strcmp(e.extensionName,
+                      VK_EXT_PIPELINE_CREATION_FEEDBACK_EXTENSION_NAME) == 0) {
+      creation_feedback_ = true;
+    } else if (strcmp(e.extensionName,
+                      VK_EXT_EXTENDED_DYNAMIC_STATE_EXTENSION_NAME) == 0) {
+      dynamicStateExtension = true;
+    } else if (strcmp(e.extensionName, VK_KHR_PIPELINE_LIBRARY_EXTENSION_NAME) ==
+               0) {
+      libraryExtensions[0] = true;
+    } else if (strcmp(e.extensionName,
+                      VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME) == 0) {
+      libraryExtensions[1] = true;
+    }
+  }
+  descriptor_indexing_ = descriptor_indexing_ && indexingExtension;
+  extended_dynamic_state_ = extended_dynamic_state_ && dynamicStateExtension;
+  pipeline_library_ =
+      pipeline_library_ && libraryExtensions[0] && libraryExtensions[1];
+
+  void* next = nullptr;
+  if (descriptor_indexing_) {
+    enabledExtensions.push_back(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+    indexingFeatures.setPNext(next);
+    next = &indexingFeatures;
+  }
+  if (creation_feedback_) {
+    enabledExtensions.push_back(VK_EXT_PIPELINE_CREATION_FEEDBACK_EXTENSION_NAME);
+  }
+  if (extended_dynamic_state_) {
+    enabledExtensions.push_back(VK_EXT_EXTENDED_DYNAMIC_STATE_EXTENSION_NAME);
+    dynamicStateFeatures.setPNext(next);
+    next = &dynamicStateFeatures;
+  }
+  if (pipeline_library_) {
+    enabledExtensions.push_back(VK_KHR_PIPELINE_LIBRARY_EXTENSION_NAME);
+    enabledExtensions.push_back(VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME);
+    libraryFeatures.setPNext(next);
+    next = &libraryFeatures;
+  }
+
   vk::DeviceCreateInfo deviceCI =
       vk::DeviceCreateInfo()
           .setQueueCreateInfoCount(1)
           .setQueueCreateInfos(queueCreateInfos)
           .setPEnabledExtensionNames(enabledExtensions)
           .setPEnabledLayerNames(kEnabledLayers)
-          .setPEnabledFeatures(nullptr);
+          .setPEnabledFeatures(nullptr)
+          .setPNext(next);
 
   result = gpu_.createDevice(&deviceCI, nullptr, &device_);
   assert(result == vk::Result::eSuccess);
+
+  dispatch_.init(static_cast<VkInstance>(instance_), vkGetInstanceProcAddr,
+                 static_cast<VkDevice>(device_), vkGetDeviceProcAddr);
+}
+
+void Device::CreateBindlessTable() {
+  if (!descriptor_indexing_) {
+    return;
+  }
+
+  auto props = gpu_.getProperties2<vk::PhysicalDeviceProperties2,
+                                   vk::PhysicalDeviceDescriptorIndexingPropertiesEXT>();
+  const auto& limits =
+      props.get<vk::PhysicalDeviceDescriptorIndexingPropertiesEXT>();
+  uint32_t capacity = std::min<uint32_t>(
+      {(uint32_t)MAX_BINDLESS_TEXTURES,
+       limits.maxDescriptorSetUpdateAfterBindSampledImages,
+       limits.maxDescriptorSetUpdateAfterBindSamplers,
+       limits.maxPerStageDescriptorUpdateAfterBindSampledImages,
+       limits.maxPerStageDescriptorUpdateAfterBindSamplers});
+  bindless_ = std::make_unique<BindlessTable>(device_, capacity);
+  if (!*bindless_) {
+    bindless_.reset();
+  }
 }
 
 void Device::GetQueues() {
@@ -584,10 +841,12 @@ void Device::CreateSyncObject() {
   fences_ = std::make_unique<vk::Fence[]>(frame_count_);
   image_acquired_ = std::make_unique<vk::Semaphore[]>(frame_count_);
   render_complete_ = std::make_unique<vk::Semaphore[]>(frame_count_);
+  fence_serials_ = std::make_unique<uint64_t[]>(frame_count_);
 
   for (uint32_t i = 0; i < frame_count_; i++) {
     result = device_.createFence(&fenceCI, nullptr, &fences_[i]);
     assert(result == vk::Result::eSuccess);
+    fence_serials_[i] = submit_serial_;
 
     result = device_.createSemaphore(&semaphoreCreateInfo, nullptr,
                                      &image_acquired_[i]);
@@ -600,17 +859,17 @@ void Device::CreateSyncObject() {
   frame_index_ = 0;
 }
 
-vk::DeviceMemory
-DeviceResource::CreateMemory(const vk::MemoryRequirements& req,
-                             vk::MemoryPropertyFlags flags) const {
-  vk::MemoryAllocateInfo memoryAI = vk::MemoryAllocateInfo();
-  memoryAI.setAllocationSize(req.size);
-  memoryAI.setMemoryTypeIndex(0);
-  if (!parent_->FindMemoryType(req.memoryTypeBits, flags,
-                               memoryAI.memoryTypeIndex)) {
-    return VK_NULL_HANDLE;
+Allocation DeviceResource::CreateMemory(const vk::MemoryRequirements& req,
+                                        vk::MemoryPropertyFlags flags,
+                                        MemoryClass cls,
+                                        Relocatable* owner) const {
+  uint32_t typeIndex = 0;
+  if (!parent_->FindMemoryType(req.memoryTypeBits, flags, typeIndex)) {
+    return Allocation();
   }
-  return device().allocateMemory(memoryAI);
+  // Mapped memory stays in its own block so it can be mapped at any time.
+  bool dedicated = !!(flags & vk::MemoryPropertyFlagBits::eHostVisible);
+  return parent_->allocator_->Allocate(req, typeIndex, cls, dedicated, owner);
 }
 
 vk::Buffer DeviceResource::CreateBuffer(vk::BufferUsageFlags flags,
@@ -661,6 +920,96 @@ bool DeviceResource::CopyBuffer2Image(const vk::Buffer& srcBuffer,
   return true;
 }
 
+bool DeviceResource::CopyToHost(
+    const std::function<void(const vk::CommandBuffer& cmd,
+                             const vk::Buffer& dst)>& record,
+    void* data, size_t size) const {
+  if (!data || !size) {
+    return false;
+  }
+  auto buffer = CreateBuffer(vk::BufferUsageFlagBits::eTransferDst, size);
+  if (!buffer) {
+    return false;
+  }
+  auto memory = CreateMemory(device().getBufferMemoryRequirements(buffer),
+                             vk::MemoryPropertyFlagBits::eHostVisible |
+                                 vk::MemoryPropertyFlagBits::eHostCoherent,
+                             MemoryClass::kStaging);
+  auto cmd = memory ? BeginOnceCmd() : vk::CommandBuffer();
+  if (!cmd) {
+    Release(buffer);
+    Release(memory);
+    return false;
+  }
+  device().bindBufferMemory(buffer, memory.memory(), memory.offset);
+
+  auto toTransfer =
+      vk::MemoryBarrier()
+          .setSrcAccessMask(vk::AccessFlagBits::eShaderWrite |
+                            vk::AccessFlagBits::eTransferWrite)
+          .setDstAccessMask(vk::AccessFlagBits::eTransferRead);
+  cmd.pipelineBarrier(vk::PipelineStageFlagBits::eAllCommands,
+                      vk::PipelineStageFlagBits::eTransfer,
+                      (vk::DependencyFlagBits)0, 1, &toTransfer, 0, nullptr, 0,
+                      nullptr);
+  record(cmd, buffer);
+  auto toHost = vk::MemoryBarrier()
+                    .setSrcAccessMask(vk::AccessFlagBits::eTransferWrite)
+                    .setDstAccessMask(vk::AccessFlagBits::eHostRead);
+  cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+                      vk::PipelineStageFlagBits::eHost,
+                      (vk::DependencyFlagBits)0, 1, &toHost, 0, nullptr, 0,
+                      nullptr);
+  EndOnceCmd(cmd);
+
+  auto* mapData = device().mapMemory(memory.memory(), memory.offset, size);
+  if (mapData) {
+    memcpy(data, mapData, size);
+    device().unmapMemory(memory.memory());
+  }
+  Release(buffer);
+  Release(memory);
+  return mapData != nullptr;
+}
+
+void DeviceResource::Release(vk::DeviceMemory& memory) const {
+  if (memory) {
+    auto dev = device();
+    auto old = memory;
+    parent_->Retire([dev, old]() { dev.free(old); });
+    memory = vk::DeviceMemory();
+  }
+}
+
+void DeviceResource::Release(vk::DescriptorSet& set) const {
+  if (set) {
+    auto* descriptors = parent_->descriptors_.get();
+    auto old = set;
+    parent_->Retire([descriptors, old]() { descriptors->Free(old); });
+    set = vk::DescriptorSet();
+  }
+}
+
+void DeviceResource::ReleaseBindless(uint32_t& index) const {
+  if (index != UINT32_MAX && parent_->bindless_) {
+    auto* table = parent_->bindless_.get();
+    auto old = index;
+    parent_->Retire([table, old]() { table->Free(old); });
+  }
+  index = UINT32_MAX;
+}
+
+void DeviceResource::Release(Allocation& alloc) const {
+  if (alloc) {
+    auto* allocator = parent_->allocator_.get();
+    auto old = alloc;
+    // The owner may be gone or hold a new range by the time the free runs.
+    allocator->Disown(old);
+    parent_->Retire([allocator, old]() { allocator->Free(old); });
+    alloc = Allocation();
+  }
+}
+
 std::unique_ptr<VPP::impl::StageBuffer>
 DeviceResource::CreateStageBuffer(const void* data, size_t size) {
   return std::make_unique<StageBuffer>(parent_, data, size);
@@ -741,23 +1090,20 @@ StageBuffer::StageBuffer(Device* parent, const void* data, size_t size)
   }
   memory_ = CreateMemory(device().getBufferMemoryRequirements(buffer_),
                          vk::MemoryPropertyFlagBits::eHostVisible |
-                             vk::MemoryPropertyFlagBits::eHostCoherent);
+                             vk::MemoryPropertyFlagBits::eHostCoherent,
+                         MemoryClass::kStaging);
   if (!memory_) {
     return;
   }
-  device().bindBufferMemory(buffer_, memory_, 0);
-  auto* mapData = device().mapMemory(memory_, 0, size_);
+  device().bindBufferMemory(buffer_, memory_.memory(), memory_.offset);
+  auto* mapData = device().mapMemory(memory_.memory(), memory_.offset, size_);
   memcpy(mapData, data, size_);
-  device().unmapMemory(memory_);
+  device().unmapMemory(memory_.memory());
 }
 
 StageBuffer::~StageBuffer() {
-  if (buffer_) {
-    device().destroy(buffer_);
-  }
-  if (memory_) {
-    device().free(memory_);
-  }
+  Release(buffer_);
+  Release(memory_);
 }
 
 bool StageBuffer::CopyToBuffer(const vk::Buffer& dstBuffer) {
@@ -773,5 +1119,23 @@ DeviceResource::DeviceResource(Device* parent) : parent_(parent) { }
 
 DeviceResource::~DeviceResource() {}
 
+void DeletionQueue::Push(uint64_t serial, std::function<void()>&& deleter) {
+  entries_.emplace_back(serial, std::move(deleter));
+}
+
+void DeletionQueue::Collect(uint64_t completed) {
+  while (!entries_.empty() && entries_.front().first <= completed) {
+    entries_.front().second();
+    entries_.pop_front();
+  }
+}
+
+void DeletionQueue::Flush() {
+  for (auto& e : entries_) {
+    e.second();
+  }
+  entries_.clear();
+}
+
 } // namespace impl
 } // namespace VPP
\ No newline at end of file
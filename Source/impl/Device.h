@@ -2,6 +2,15 @@
 
 #include <vulkan/vulkan.hpp>
 
+#include <deque>
+#include <functional>
+#include <string>
+
+#include "Descriptor.h"
+#include "Memory.h"
+#include "ObjectCache.h"
+#include "PipelineCache.h"
+#include "ThreadPool.h"
 #include "Window.h"
 
 namespace VPP {
@@ -9,6 +18,19 @@ namespace impl {
 
 class DrawParam;
 
+class DeletionQueue {
+public:
+  void Push(uint64_t serial, std::function<void()>&& deleter);
+  // Frees every entry retired at or before the completed submission serial.
+  void Collect(uint64_t completed);
+  void Flush();
+
+  bool empty() const { return entries_.empty(); }
+
+private:
+  std::deque<std::pair<uint64_t, std::function<void()>>> entries_{};
+};
+
 class Device {
   friend class DeviceResource;
 
@@ -24,11 +46,26 @@ public:
   void Draw();
   void EndDraw();
 
+  // Bytes the defragmenter may copy per frame, 0 disables it.
+  void SetDefragBudget(vk::DeviceSize bytes) { defrag_budget_ = bytes; }
+
+  // Set once VK_EXT_descriptor_indexing is available on the GPU.
+  bool SupportsBindless() const { return bindless_ != nullptr; }
+
+  PipelineCacheStats GetPipelineCacheStats() const {
+    return pipeline_cache_->stats();
+  }
+
+  MemoryStats GetMemoryStats() const;
+  std::string DumpMemoryStats() const;
+  bool DumpMemoryStats(const char* fn) const;
+
 private:
   void CreateInstance(SDL_Window* window);
   void CreateSurface(SDL_Window* window);
   void SetGpuAndIndices();
   void CreateDevice();
+  void CreateBindlessTable();
   void GetQueues();
   void CreateSyncObject();
   void CreateSwapchainResource(vk::SwapchainKHR oldSwapchain);
@@ -41,6 +78,9 @@ private:
   void CreateCommandBuffers();
   bool FindMemoryType(uint32_t memType, vk::MemoryPropertyFlags mask,
                       uint32_t& typeIndex) const;
+  void Retire(std::function<void()>&& deleter);
+  void CollectGarbage(uint64_t completed);
+  bool Defragment();
 
 private:
   vk::Instance instance_{};
@@ -60,6 +100,25 @@ private:
   std::unique_ptr<vk::Fence[]> fences_{};
   std::unique_ptr<vk::Semaphore[]> image_acquired_{};
   std::unique_ptr<vk::Semaphore[]> render_complete_{};
+  std::unique_ptr<uint64_t[]> fence_serials_{};
+
+  uint64_t submit_serial_{0};
+  uint64_t complete_serial_{0};
+  DeletionQueue deletion_queue_{};
+  std::unique_ptr<MemoryAllocator> allocator_{};
+  std::unique_ptr<DescriptorAllocator> descriptors_{};
+  std::vector<std::unique_ptr<DescriptorAllocator>> frame_descriptors_{};
+  bool descriptor_indexing_{false};
+  std::unique_ptr<BindlessTable> bindless_{};
+  bool creation_feedback_{false};
+  bool extended_dynamic_state_{false};
+  bool pipeline_library_{false};
+  // Extension entry points, the static loader only has core functions.
+  vk::DispatchLoaderDynamic dispatch_{};
+  std::unique_ptr<PipelineCache> pipeline_cache_{};
+  ObjectCache objects_{};
+  std::unique_ptr<ThreadPool> workers_{};
+  vk::DeviceSize defrag_budget_{4ull << 20};
 
   vk::SwapchainKHR swapchain_{};
   vk::Extent2D extent_{};
@@ -72,13 +131,14 @@ private:
 
   vk::Image depth_image_{};
   vk::ImageView depth_imageview_{};
-  vk::DeviceMemory depth_memory_{};
+  Allocation depth_memory_{};
 
   vk::RenderPass render_pass_{};
   std::unique_ptr<vk::Framebuffer[]> framebuffers_{};
 
   vk::CommandPool command_pool_{};
   std::unique_ptr<vk::CommandBuffer[]> commands_{};
+  vk::CommandBuffer defrag_command_{};
 
   const DrawParam* cmd_;
 };
@@ -94,20 +154,72 @@ protected:
   const vk::PhysicalDevice& gpu() const { return parent_->gpu_; }
   const vk::RenderPass& render_pass() const { return parent_->render_pass_; }
   const vk::Extent2D& surface_extent() const { return parent_->extent_; }
-  vk::DeviceMemory CreateMemory(const vk::MemoryRequirements& req,
-                                vk::MemoryPropertyFlags flags) const;
+  DescriptorAllocator& descriptors() const { return *parent_->descriptors_; }
+  // Sets from here are recycled once the current frame slot comes round.
+  DescriptorAllocator& frame_descriptors() const {
+    return *parent_->frame_descriptors_[parent_->frame_index_];
+  }
+  // Null when the GPU has no descriptor indexing support.
+  BindlessTable* bindless() const { return parent_->bindless_.get(); }
+  PipelineCache& pipeline_cache() const { return *parent_->pipeline_cache_; }
+  ObjectCache& objects() const { return parent_->objects_; }
+  ThreadPool& workers() const { return *parent_->workers_; }
+  // VK_EXT_pipeline_creation_feedback can be chained into pipeline creation.
+  bool creation_feedback() const { return parent_->creation_feedback_; }
+  // Pipelines leave cull, front face, topology and depth state dynamic.
+  bool extended_dynamic_state() const {
+    return parent_->extended_dynamic_state_;
+  }
+  // VK_EXT_graphics_pipeline_library is enabled.
+  bool pipeline_library() const { return parent_->pipeline_library_; }
+  const vk::DispatchLoaderDynamic& dispatch() const {
+    return parent_->dispatch_;
+  }
+  Allocation CreateMemory(const vk::MemoryRequirements& req,
+                          vk::MemoryPropertyFlags flags, MemoryClass cls,
+                          Relocatable* owner = nullptr) const;
   vk::Buffer CreateBuffer(vk::BufferUsageFlags flags, size_t size) const;
   bool CopyBuffer2Buffer(const vk::Buffer& srcBuffer,
                          const vk::Buffer& dstBuffer, size_t size) const;
   bool CopyBuffer2Image(const vk::Buffer& srcBuffer, const vk::Image& dstBuffer,
                         uint32_t width, uint32_t height,
                         uint32_t channel) const;
+  // Reads back through a host-visible buffer that record copies size bytes
+  // into, after every earlier GPU write. Blocks until the copy is done.
+  bool CopyToHost(const std::function<void(const vk::CommandBuffer& cmd,
+                                           const vk::Buffer& dst)>& record,
+                  void* data, size_t size) const;
 
   std::unique_ptr<StageBuffer> CreateStageBuffer(const void* data, size_t size);
 
-private:
+  // Handles are destroyed once the GPU can no longer reference them.
+  template <typename T> void Release(T& handle) const {
+    if (handle) {
+      auto dev = device();
+      auto old = handle;
+      parent_->Retire([dev, old]() { dev.destroy(old); });
+      handle = T();
+    }
+  }
+  void Release(vk::DeviceMemory& memory) const;
+  void Release(Allocation& alloc) const;
+  void Release(vk::DescriptorSet& set) const;
+  // Returns an index of the bindless table, reset to UINT32_MAX.
+  void ReleaseBindless(uint32_t& index) const;
+  // Drops a cached handle, destroying it with the last reference.
+  template <typename T>
+  void ReleaseShared(HandleCache<T>& cache, T& handle) const {
+    if (handle && cache.Release(handle)) {
+      Release(handle);
+    }
+    handle = T();
+  }
+  // Records on a one-time command buffer, EndOnceCmd submits it and waits
+  // for the queue to go idle.
   vk::CommandBuffer BeginOnceCmd() const;
   void EndOnceCmd(vk::CommandBuffer& cmd) const;
+
+private:
   void SetImageForTransfer(const vk::CommandBuffer& cmd,
                            const vk::Image& image) const;
   void SetImageForShader(const vk::CommandBuffer& cmd,
@@ -124,11 +236,12 @@ public:
   bool CopyToBuffer(const vk::Buffer& dstBuffer);
   bool CopyToImage(const vk::Image& dstImage, uint32_t width, uint32_t height,
               uint32_t channel);
+  const vk::Buffer& buffer() const { return buffer_; }
 
 private:
   size_t size_ = 0;
   vk::Buffer buffer_{};
-  vk::DeviceMemory memory_{};
+  Allocation memory_{};
 };
 
 } // namespace impl
@@ -1,19 +1,143 @@
 #include "DrawCmd.h"
 
+#include <iostream>
+
 #include "Pipeline.h"
 
 namespace VPP {
 
 namespace impl {
 
+// Start, end of the prepass and end of shading.
+static const uint32_t kTimestampCount = 3;
+
+DrawParam::DrawParam(Device* parent) : DeviceResource(parent) {
+  auto limits = gpu().getProperties().limits;
+  if (!limits.timestampComputeAndGraphics) {
+    return;
+  }
+  auto queryCI = vk::QueryPoolCreateInfo()
+                     .setQueryType(vk::QueryType::eTimestamp)
+                     .setQueryCount(kTimestampCount);
+  timestamps_ = device().createQueryPool(queryCI);
+  timestamp_period_ = limits.timestampPeriod;
+}
+
+DrawParam::~DrawParam() {
+  ReleaseSets();
+  Release(timestamps_);
+}
+
+void DrawParam::ReleaseSets() {
+  for (auto& e : descriptor_sets_) {
+    // The bindless set is shared, it is only referenced here.
+    if (bindless() && e == bindless()->set()) {
+      continue;
+    }
+    Release(e);
+  }
+  descriptor_sets_.clear();
+}
+
+void DrawParam::SetPipeline(Pipeline& pipeline) {
+  if (!vertices_ || !pipeline.Compile(*vertices_)) {
+    return;
+  }
+  pipeline_ = &pipeline;
+
+  // Sets are kept across pipelines sharing the same layouts.
+  if (set_layouts_ == pipeline.desc_layout_) {
+    return;
+  }
+  ReleaseSets();
+  bindings_.clear();
+  frame_sets_.clear();
+  set_layouts_ = pipeline.desc_layout_;
+
+  descriptor_sets_.resize(set_layouts_.size());
+  for (size_t i = 0; i < set_layouts_.size(); i++) {
+    if (bindless() && set_layouts_[i] == bindless()->layout()) {
+      descriptor_sets_[i] = bindless()->set();
+      continue;
+    }
+    if (!descriptors().Allocate(set_layouts_[i], descriptor_sets_[i])) {
+      std::cerr << "Fail to allocate descriptor set " << i << std::endl;
+    }
+  }
+}
+
+void DrawParam::SetFallbackPipeline(Pipeline& pipeline) {
+  if (!vertices_ || !pipeline.Compile(*vertices_)) {
+    return;
+  }
+  fallback_ = &pipeline;
+}
+
+void DrawParam::SetDepthPrepass(Pipeline& depth, Pipeline& shading) {
+  if (!vertices_ || !depth.Compile(*vertices_) ||
+      !shading.Compile(*vertices_)) {
+    return;
+  }
+  prepass_depth_ = &depth;
+  prepass_shading_ = &shading;
+}
+
+void DrawParam::ReadTimings() const {
+  if (!timestamps_ || !timestamps_written_) {
+    return;
+  }
+  // Call runs after the previous submission's fence, results are final.
+  uint64_t values[kTimestampCount]{};
+  auto result = device().getQueryPoolResults(
+      timestamps_, 0, kTimestampCount, sizeof(values), values,
+      sizeof(uint64_t), vk::QueryResultFlagBits::e64);
+  if (result != vk::Result::eSuccess) {
+    return;
+  }
+  auto toMs = [this](uint64_t begin, uint64_t end) {
+    return (float)((end - begin) * timestamp_period_ / 1e6);
+  };
+  timings_.prepass_ms = toMs(values[0], values[1]);
+  timings_.shading_ms = toMs(values[1], values[2]);
+}
+
+void DrawParam::DrawWith(const vk::CommandBuffer& buf,
+                         const Pipeline& pipeline,
+                         const std::vector<vk::DescriptorSet>& sets) const {
+  pipeline.BindCmd(buf);
+  if (!sets.empty()) {
+    std::vector<uint32_t> offset{};
+    buf.bindDescriptorSets(vk::PipelineBindPoint::eGraphics,
+                           pipeline.pipe_layout_, 0, sets, offset);
+  }
+  for (const auto& e : pipeline.push_spans_) {
+    if (e.offset >= push_data_.size()) {
+      continue;
+    }
+    auto size =
+        std::min<uint32_t>(e.size, (uint32_t)push_data_.size() - e.offset);
+    buf.pushConstants(pipeline.pipe_layout_, e.stageFlags, e.offset, size,
+                      push_data_.data() + e.offset);
+  }
+  vertices_->BindCmd(buf);
+  vertices_->DrawAtCmd(buf);
+}
+
 void DrawParam::Call(const vk::CommandBuffer& buf,
                      const vk::Framebuffer& framebuffer,
                      const vk::RenderPass& renderpass) const {
   if (!pipeline_ || !vertices_ || !buf) {
     return;
   }
+  RefreshBindings();
+  ReadTimings();
+
   auto beginInfo = vk::CommandBufferBeginInfo();
   buf.begin(beginInfo);
+  if (timestamps_) {
+    buf.resetQueryPool(timestamps_, 0, kTimestampCount);
+  }
+  RecordDispatches(buf);
 
   const auto rpBegin =
       vk::RenderPassBeginInfo()
@@ -33,35 +157,157 @@ void DrawParam::Call(const vk::CommandBuffer& buf,
   std::vector<vk::Rect2D> scissors = {vk::Rect2D{vk::Offset2D(0, 0), extent}};
   buf.setScissor(0, scissors);
 
-  pipeline_->BindCmd(buf);
-  vertices_->BindCmd(buf);
-  vertices_->DrawAtCmd(buf);
+  // Sets and push constants were laid out for pipeline_, a fallback is
+  // only usable when it shares the pipeline layout.
+  const Pipeline* pipeline = pipeline_->ready() ? pipeline_ : nullptr;
+  if (!pipeline && fallback_ && fallback_->ready() &&
+      fallback_->pipe_layout_ == pipeline_->pipe_layout_) {
+    pipeline = fallback_;
+  }
+
+  // Transient sets are written for this frame only, the layouts match
+  // every pipeline drawn below.
+  auto sets = descriptor_sets_;
+  for (const auto& e : frame_sets_) {
+    vk::DescriptorSet set{};
+    if (!frame_descriptors().Allocate(set_layouts_[e.first], set)) {
+      std::cerr << "Fail to allocate frame descriptor set " << e.first
+                << std::endl;
+      continue;
+    }
+    device().updateDescriptorSetWithTemplate(
+        set, pipeline_->update_templates_[e.first], e.second.data());
+    sets[e.first] = set;
+  }
+
+  // The prepass variants must share the layout to reuse the bound sets.
+  bool prepass = prepass_enabled_ && pipeline == pipeline_ && prepass_depth_ &&
+                 prepass_shading_ && prepass_depth_->ready() &&
+                 prepass_shading_->ready() &&
+                 prepass_depth_->pipe_layout_ == pipeline_->pipe_layout_ &&
+                 prepass_shading_->pipe_layout_ == pipeline_->pipe_layout_;
+
+  if (timestamps_) {
+    buf.writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe, timestamps_, 0);
+  }
+  if (prepass) {
+    DrawWith(buf, *prepass_depth_, sets);
+  }
+  if (timestamps_) {
+    buf.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, timestamps_,
+                       1);
+  }
+  if (prepass) {
+    DrawWith(buf, *prepass_shading_, sets);
+  } else if (pipeline) {
+    DrawWith(buf, *pipeline, sets);
+  }
+  if (timestamps_) {
+    buf.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, timestamps_,
+                       2);
+    timestamps_written_ = true;
+  }
 
   buf.endRenderPass();
   buf.end();
 }
 
+void DrawParam::AddDispatch(const DispatchParam& param, uint32_t x,
+                            uint32_t y, uint32_t z) {
+  ComputeCall call{};
+  call.param = &param;
+  call.groups[0] = x;
+  call.groups[1] = y;
+  call.groups[2] = z;
+  dispatches_.push_back(call);
+}
+
+void DrawParam::AddDispatchIndirect(const DispatchParam& param,
+                                    const vk::Buffer& args,
+                                    vk::DeviceSize offset) {
+  ComputeCall call{};
+  call.param = &param;
+  call.args = args;
+  call.offset = offset;
+  dispatches_.push_back(call);
+}
+
+void DrawParam::RecordDispatches(const vk::CommandBuffer& buf) const {
+  // The barrier after each dispatch covers the following dispatches as well
+  // as the draws of the pass.
+  for (const auto& e : dispatches_) {
+    bool recorded =
+        e.args ? e.param->DispatchIndirectCmd(buf, e.args, e.offset)
+               : e.param->DispatchCmd(buf, e.groups[0], e.groups[1],
+                                      e.groups[2]);
+    if (recorded) {
+      RecordComputeBarrier(buf);
+    }
+  }
+}
+
+bool DrawParam::SetPushConstant(uint32_t offset, const void* data,
+                                uint32_t size) {
+  if (!pipeline_ || !data || !size || offset % 4 != 0 || size % 4 != 0) {
+    return false;
+  }
+
+  uint32_t limit = 0;
+  for (const auto& e : pipeline_->push_ranges_) {
+    limit = std::max(limit, e.offset + e.size);
+  }
+  if (offset + size > limit) {
+    return false;
+  }
+
+  if (push_data_.size() < offset + size) {
+    push_data_.resize(offset + size);
+  }
+  memcpy(push_data_.data() + offset, data, size);
+  return true;
+}
+
+bool DrawParam::UpdateSet(uint32_t set, const DescriptorInfo* infos) {
+  if (!pipeline_ || !infos || set >= descriptor_sets_.size() ||
+      set >= pipeline_->update_templates_.size() ||
+      !pipeline_->update_templates_[set]) {
+    return false;
+  }
+  device().updateDescriptorSetWithTemplate(
+      descriptor_sets_[set], pipeline_->update_templates_[set], infos);
+  frame_sets_.erase(set);
+  return true;
+}
+
+bool DrawParam::UpdateFrameSet(uint32_t set, const DescriptorInfo* infos) {
+  if (!pipeline_ || !infos || set >= descriptor_sets_.size() ||
+      set >= pipeline_->update_templates_.size() ||
+      !pipeline_->update_templates_[set]) {
+    return false;
+  }
+  auto count = pipeline_->GetDescriptorCount(set);
+  frame_sets_[set].assign(infos, infos + count);
+  return true;
+}
+
 bool DrawParam::BindTexture(uint32_t slot, uint32_t set, uint32_t binding) {
   auto iter =
       std::find_if(sampler_textures_.begin(), sampler_textures_.end(),
                    [slot](const std::pair<uint32_t, const SamplerTexture*>& e) {
                      return e.first == slot;
                    });
-  if (iter == sampler_textures_.end()) {
+  if (iter == sampler_textures_.end() || set >= descriptor_sets_.size()) {
     return false;
   }
-  auto imageInfo = vk::DescriptorImageInfo()
-                       .setImageView(iter->second->view())
-                       .setSampler(iter->second->sampler())
-                       .setImageLayout(vk::ImageLayout::eShaderReadOnlyOptimal);
+  WriteTexture(*iter->second, set, binding);
 
-  auto write = vk::WriteDescriptorSet()
-                   .setDescriptorCount(1)
-                   .setDescriptorType(vk::DescriptorType::eCombinedImageSampler)
-                   .setDstSet(pipeline_->descriptor_sets_[set])
-                   .setDstBinding(binding)
-                   .setPImageInfo(&imageInfo);
-  device().updateDescriptorSets(1, &write, 0, nullptr);
+  Binding bind{};
+  bind.slot = slot;
+  bind.set = set;
+  bind.binding = binding;
+  bind.kind = Kind::kTexture;
+  bind.revision = iter->second->revision();
+  AddBinding(bind);
   return true;
 }
 
@@ -71,23 +317,164 @@ bool DrawParam::BindUniform(uint32_t slot, uint32_t set, uint32_t binding) {
         [slot](const std::pair<uint32_t, const UniformBuffer*>& e) {
         return e.first == slot;
     });
-    if (iter == uniform_buffers_.end()) {
+    if (iter == uniform_buffers_.end() || set >= descriptor_sets_.size()) {
         return false;
     }
-    auto bufferInfo = vk::DescriptorBufferInfo()
-        .setBuffer(iter->second->buffer())
-        .setOffset(0)
-        .setRange(iter->second->size());
-
-    auto write = vk::WriteDescriptorSet()
-        .setDescriptorCount(1)
-        .setDescriptorType(vk::DescriptorType::eUniformBuffer)
-        .setDstSet(pipeline_->descriptor_sets_[set])
-        .setDstBinding(binding)
-        .setPBufferInfo(&bufferInfo);
-    device().updateDescriptorSets(1, &write, 0, nullptr);
+    WriteUniform(*iter->second, set, binding);
+
+    Binding bind{};
+    bind.slot = slot;
+    bind.set = set;
+    bind.binding = binding;
+    bind.kind = Kind::kUniform;
+    bind.revision = iter->second->revision();
+    AddBinding(bind);
     return true;
 }
 
+bool DrawParam::BindStorageBuffer(uint32_t slot, uint32_t set,
+                                  uint32_t binding) {
+  const auto* buf = FindSlot(storage_buffers_, slot);
+  if (!buf || set >= descriptor_sets_.size()) {
+    return false;
+  }
+  WriteStorage(*buf, set, binding);
+
+  Binding bind{};
+  bind.slot = slot;
+  bind.set = set;
+  bind.binding = binding;
+  bind.kind = Kind::kStorageBuffer;
+  bind.revision = buf->revision();
+  AddBinding(bind);
+  return true;
+}
+
+bool DrawParam::BindStorageImage(uint32_t slot, uint32_t set,
+                                 uint32_t binding) {
+  const auto* image = FindSlot(storage_images_, slot);
+  if (!image || set >= descriptor_sets_.size()) {
+    return false;
+  }
+  WriteStorage(*image, set, binding);
+
+  Binding bind{};
+  bind.slot = slot;
+  bind.set = set;
+  bind.binding = binding;
+  bind.kind = Kind::kStorageImage;
+  bind.revision = image->revision();
+  AddBinding(bind);
+  return true;
+}
+
+void DrawParam::WriteTexture(const SamplerTexture& tex, uint32_t set,
+                             uint32_t binding) const {
+  auto imageInfo = vk::DescriptorImageInfo()
+                       .setImageView(tex.view())
+                       .setSampler(tex.sampler())
+                       .setImageLayout(vk::ImageLayout::eShaderReadOnlyOptimal);
+
+  auto write = vk::WriteDescriptorSet()
+                   .setDescriptorCount(1)
+                   .setDescriptorType(vk::DescriptorType::eCombinedImageSampler)
+                   .setDstSet(descriptor_sets_[set])
+                   .setDstBinding(binding)
+                   .setPImageInfo(&imageInfo);
+  device().updateDescriptorSets(1, &write, 0, nullptr);
+}
+
+void DrawParam::WriteUniform(const UniformBuffer& buf, uint32_t set,
+                             uint32_t binding) const {
+  auto bufferInfo = vk::DescriptorBufferInfo()
+                        .setBuffer(buf.buffer())
+                        .setOffset(0)
+                        .setRange(buf.size());
+
+  auto write = vk::WriteDescriptorSet()
+                   .setDescriptorCount(1)
+                   .setDescriptorType(vk::DescriptorType::eUniformBuffer)
+                   .setDstSet(descriptor_sets_[set])
+                   .setDstBinding(binding)
+                   .setPBufferInfo(&bufferInfo);
+  device().updateDescriptorSets(1, &write, 0, nullptr);
+}
+
+void DrawParam::WriteStorage(const StorageBuffer& buf, uint32_t set,
+                             uint32_t binding) const {
+  auto bufferInfo = vk::DescriptorBufferInfo()
+                        .setBuffer(buf.buffer())
+                        .setOffset(0)
+                        .setRange(buf.size());
+
+  auto write = vk::WriteDescriptorSet()
+                   .setDescriptorCount(1)
+                   .setDescriptorType(vk::DescriptorType::eStorageBuffer)
+                   .setDstSet(descriptor_sets_[set])
+                   .setDstBinding(binding)
+                   .setPBufferInfo(&bufferInfo);
+  device().updateDescriptorSets(1, &write, 0, nullptr);
+}
+
+void DrawParam::WriteStorage(const StorageImage& image, uint32_t set,
+                             uint32_t binding) const {
+  auto imageInfo = vk::DescriptorImageInfo()
+                       .setImageView(image.view())
+                       .setImageLayout(vk::ImageLayout::eGeneral);
+
+  auto write = vk::WriteDescriptorSet()
+                   .setDescriptorCount(1)
+                   .setDescriptorType(vk::DescriptorType::eStorageImage)
+                   .setDstSet(descriptor_sets_[set])
+                   .setDstBinding(binding)
+                   .setPImageInfo(&imageInfo);
+  device().updateDescriptorSets(1, &write, 0, nullptr);
+}
+
+void DrawParam::AddBinding(const Binding& bind) {
+  auto iter = std::find_if(bindings_.begin(), bindings_.end(),
+                           [&bind](const Binding& e) {
+                             return e.set == bind.set &&
+                                    e.binding == bind.binding;
+                           });
+  if (iter == bindings_.end()) {
+    bindings_.push_back(bind);
+  } else {
+    *iter = bind;
+  }
+}
+
+void DrawParam::RefreshBindings() const {
+  for (auto& e : bindings_) {
+    if (e.kind == Kind::kTexture) {
+      for (const auto& tex : sampler_textures_) {
+        if (tex.first == e.slot && tex.second->revision() != e.revision) {
+          WriteTexture(*tex.second, e.set, e.binding);
+          e.revision = tex.second->revision();
+        }
+      }
+    } else if (e.kind == Kind::kUniform) {
+      for (const auto& buf : uniform_buffers_) {
+        if (buf.first == e.slot && buf.second->revision() != e.revision) {
+          WriteUniform(*buf.second, e.set, e.binding);
+          e.revision = buf.second->revision();
+        }
+      }
+    } else if (e.kind == Kind::kStorageBuffer) {
+      const auto* buf = FindSlot(storage_buffers_, e.slot);
+      if (buf && buf->revision() != e.revision) {
+        WriteStorage(*buf, e.set, e.binding);
+        e.revision = buf->revision();
+      }
+    } else {
+      const auto* image = FindSlot(storage_images_, e.slot);
+      if (image && image->revision() != e.revision) {
+        WriteStorage(*image, e.set, e.binding);
+        e.revision = image->revision();
+      }
+    }
+  }
+}
+
 } // namespace impl
-} // namespace VPP
+} // namespace VPP
\ No newline at end of file
@@ -5,6 +5,7 @@
 #include <map>
 
 #include "Buffer.h"
+#include "Compute.h"
 #include "Device.h"
 #include "Image.h"
 #include "Pipeline.h"
@@ -13,18 +14,34 @@ namespace VPP {
 
 namespace impl {
 
+// GPU time of the last finished frame, zero without timestamp support.
+struct PassTimings {
+  float prepass_ms = 0.f;
+  float shading_ms = 0.f;
+};
+
 class DrawParam : public DeviceResource {
 public:
-  DrawParam(Device* parent) : DeviceResource(parent) {}
+  DrawParam(Device* parent);
+  ~DrawParam();
 
   void SetClearValues(std::vector<vk::ClearValue>& clearValues) {
     clear_values_.swap(clearValues);
   }
   void SetVertexArray(VertexArray& vertex) { vertices_ = &vertex; }
-  void SetPipeline(Pipeline& pipeline) {
-    if (vertices_ && pipeline.Enable(*vertices_))
-      pipeline_ = &pipeline;
-  }
+  // The pipeline compiles in the background, draws are skipped until it is
+  // ready unless a fallback with the same pipeline layout is ready.
+  void SetPipeline(Pipeline& pipeline);
+  void SetFallbackPipeline(Pipeline& pipeline);
+  // Pipelines built from the same shaders as the main one with
+  // RenderState::DepthOnly and RenderState::DepthEqual. Opaque geometry is
+  // drawn once into depth only, then shaded where depth matches. The vertex
+  // shader must declare `invariant gl_Position;`, otherwise the two
+  // pipelines may compute different depths and drop pixels.
+  void SetDepthPrepass(Pipeline& depth, Pipeline& shading);
+  void EnableDepthPrepass(bool enable) { prepass_enabled_ = enable; }
+  bool depth_prepass() const { return prepass_enabled_; }
+  const PassTimings& timings() const { return timings_; }
   void SetTexture(uint32_t slot, SamplerTexture& tex) {
     auto iter = std::find_if(
         sampler_textures_.begin(), sampler_textures_.end(),
@@ -50,18 +67,120 @@ public:
       }
   }
 
+  void SetStorageBuffer(uint32_t slot, StorageBuffer& buf) {
+    SetSlot(storage_buffers_, slot, &buf);
+  }
+  void SetStorageImage(uint32_t slot, StorageImage& image) {
+    SetSlot(storage_images_, slot, &image);
+  }
+
+  // Data is recorded with every draw, offset and size must be multiples of 4.
+  bool SetPushConstant(uint32_t offset, const void* data, uint32_t size);
+  template <typename T> bool SetPushConstant(const T& value, uint32_t offset = 0) {
+    return SetPushConstant(offset, &value, (uint32_t)sizeof(T));
+  }
+
+  // Recorded every frame before the render pass, in the order added. Each
+  // dispatch sees the writes of the previous ones and the draw sees all.
+  void AddDispatch(const DispatchParam& param, uint32_t x, uint32_t y = 1,
+                   uint32_t z = 1);
+  void AddDispatchIndirect(const DispatchParam& param, const vk::Buffer& args,
+                           vk::DeviceSize offset = 0);
+  void ClearDispatches() { dispatches_.clear(); }
+
+  // Writes a whole set in one call, infos holds
+  // Pipeline::GetDescriptorCount(set) entries in binding order.
+  bool UpdateSet(uint32_t set, const DescriptorInfo* infos);
+  // Same layout as UpdateSet, but every frame records a fresh set from the
+  // frame's pool instead of rewriting one the GPU may still be reading.
+  // Stays in use until UpdateSet is called for the set.
+  bool UpdateFrameSet(uint32_t set, const DescriptorInfo* infos);
+
   bool BindTexture(uint32_t slot, uint32_t set, uint32_t binding);
+  bool BindStorageBuffer(uint32_t slot, uint32_t set, uint32_t binding);
+  bool BindStorageImage(uint32_t slot, uint32_t set, uint32_t binding);
   bool BindUniform(uint32_t slot, uint32_t set, uint32_t binding); // 棺descriptorCount
 
   void Call(const vk::CommandBuffer& buf, const vk::Framebuffer& framebuffer,
             const vk::RenderPass& renderpass) const;
 
 private:
+  enum class Kind { kTexture, kUniform, kStorageBuffer, kStorageImage };
+  struct Binding {
+    uint32_t slot = 0;
+    uint32_t set = 0;
+    uint32_t binding = 0;
+    Kind kind = Kind::kUniform;
+    uint32_t revision = 0;
+  };
+  struct ComputeCall {
+    const DispatchParam* param = nullptr;
+    uint32_t groups[3]{};
+    // Indirect when set.
+    vk::Buffer args{};
+    vk::DeviceSize offset = 0;
+  };
+
+  void WriteTexture(const SamplerTexture& tex, uint32_t set,
+                    uint32_t binding) const;
+  void WriteUniform(const UniformBuffer& buf, uint32_t set,
+                    uint32_t binding) const;
+  void WriteStorage(const StorageBuffer& buf, uint32_t set,
+                    uint32_t binding) const;
+  void WriteStorage(const StorageImage& image, uint32_t set,
+                    uint32_t binding) const;
+  template <typename T>
+  static void SetSlot(std::vector<std::pair<uint32_t, const T*>>& slots,
+                      uint32_t slot, const T* resource) {
+    for (auto& e : slots) {
+      if (e.first == slot) {
+        e.second = resource;
+        return;
+      }
+    }
+    slots.emplace_back(slot, resource);
+  }
+  template <typename T>
+  static const T*
+  FindSlot(const std::vector<std::pair<uint32_t, const T*>>& slots,
+           uint32_t slot) {
+    for (const auto& e : slots) {
+      if (e.first == slot) {
+        return e.second;
+      }
+    }
+    return nullptr;
+  }
+  void DrawWith(const vk::CommandBuffer& buf, const Pipeline& pipeline,
+                const std::vector<vk::DescriptorSet>& sets) const;
+  void RecordDispatches(const vk::CommandBuffer& buf) const;
+  void ReadTimings() const;
+  void AddBinding(const Binding& bind);
+  void ReleaseSets();
+  // Rewrites descriptors whose resources were recreated or relocated.
+  void RefreshBindings() const;
+
   const VertexArray* vertices_ = nullptr;
   const Pipeline* pipeline_ = nullptr;
+  const Pipeline* fallback_ = nullptr;
+  const Pipeline* prepass_depth_ = nullptr;
+  const Pipeline* prepass_shading_ = nullptr;
+  bool prepass_enabled_ = false;
+  vk::QueryPool timestamps_{};
+  float timestamp_period_ = 0.f;
+  mutable bool timestamps_written_ = false;
+  mutable PassTimings timings_{};
   std::vector<std::pair<uint32_t, const SamplerTexture*>> sampler_textures_{};
   std::vector<std::pair<uint32_t, const UniformBuffer*>> uniform_buffers_{};
+  std::vector<std::pair<uint32_t, const StorageBuffer*>> storage_buffers_{};
+  std::vector<std::pair<uint32_t, const StorageImage*>> storage_images_{};
   std::vector<vk::ClearValue> clear_values_{};
+  std::vector<vk::DescriptorSetLayout> set_layouts_{};
+  std::vector<vk::DescriptorSet> descriptor_sets_{};
+  std::map<uint32_t, std::vector<DescriptorInfo>> frame_sets_{};
+  std::vector<uint8_t> push_data_{};
+  std::vector<ComputeCall> dispatches_{};
+  mutable std::vector<Binding> bindings_{};
 };
 
 } // namespace impl
@@ -2,26 +2,29 @@
 
 namespace VPP {
 namespace impl {
-SamplerTexture::SamplerTexture(Device* parent) : DeviceResource(parent) {}
+SamplerTexture::SamplerTexture(Device* parent) : DeviceResource(parent) {
+  if (auto* table = bindless()) {
+    bindless_index_ = table->Acquire();
+  }
+}
 
 SamplerTexture::~SamplerTexture() {
-  if (sampler_) {
-    device().destroy(sampler_);
-  }
-  if (image_) {
-    device().destroy(image_);
-  }
-  if (view_) {
-    device().destroy(view_);
-  }
-  if (memory_) {
-    device().free(memory_);
-  }
+  ReleaseBindless(bindless_index_);
+  Release(sampler_);
+  Release(view_);
+  Release(image_);
+  Release(memory_);
 }
 
 bool SamplerTexture::SetImage2D(vk::Format format, uint32_t width,
                                 uint32_t height, uint32_t channel,
                                 const void* data) {
+  Release(sampler_);
+  Release(view_);
+  Release(image_);
+  Release(memory_);
+  revision_++;
+
   width_ = width;
   height_ = height;
   format_ = format;
@@ -45,7 +48,8 @@ bool SamplerTexture::SetImage2D(vk::Format format, uint32_t width,
                      .setSamples(vk::SampleCountFlagBits::e1)
                      .setTiling(vk::ImageTiling::eOptimal)
                      .setUsage(vk::ImageUsageFlagBits::eSampled |
-                               vk::ImageUsageFlagBits::eTransferDst)
+                               vk::ImageUsageFlagBits::eTransferDst |
+                               vk::ImageUsageFlagBits::eTransferSrc)
                      .setSharingMode(vk::SharingMode::eExclusive)
                      .setQueueFamilyIndexCount(0)
                      .setPQueueFamilyIndices(nullptr)
@@ -57,25 +61,19 @@ bool SamplerTexture::SetImage2D(vk::Format format, uint32_t width,
   }
 
   memory_ = CreateMemory(device().getImageMemoryRequirements(image_),
-                         vk::MemoryPropertyFlagBits::eDeviceLocal);
+                         vk::MemoryPropertyFlagBits::eDeviceLocal,
+                         MemoryClass::kTexture, this);
   if (!memory_) {
     return false;
   }
-  device().bindImageMemory(image_, memory_, 0);
+  device().bindImageMemory(image_, memory_.memory(), memory_.offset);
 
   auto stageBuffer = CreateStageBuffer(data, size);
   if (!stageBuffer->CopyToImage(image_, width_, height_, channel)) {
     return false;
   }
 
-  auto imageViewCI = vk::ImageViewCreateInfo()
-                         .setImage(image_)
-                         .setViewType(vk::ImageViewType::e2D)
-                         .setFormat(format_)
-                         .setSubresourceRange(vk::ImageSubresourceRange(
-                             vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1));
-
-  view_ = device().createImageView(imageViewCI);
+  view_ = CreateView(image_);
   if (!view_) {
     return false;
   }
@@ -101,7 +99,273 @@ bool SamplerTexture::SetImage2D(vk::Format format, uint32_t width,
     return false;
   }
 
+  if (bindless_index_ != UINT32_MAX) {
+    bindless()->Write(bindless_index_, view_, sampler_);
+  }
+  return true;
+}
+
+vk::ImageView SamplerTexture::CreateView(const vk::Image& image) const {
+  auto imageViewCI = vk::ImageViewCreateInfo()
+                         .setImage(image)
+                         .setViewType(vk::ImageViewType::e2D)
+                         .setFormat(format_)
+                         .setSubresourceRange(vk::ImageSubresourceRange(
+                             vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1));
+  return device().createImageView(imageViewCI);
+}
+
+bool SamplerTexture::Relocate(const vk::CommandBuffer& cmd,
+                              const Allocation& dst) {
+  auto imageCI = vk::ImageCreateInfo()
+                     .setImageType(vk::ImageType::e2D)
+                     .setFormat(format_)
+                     .setExtent({width_, height_, 1})
+                     .setMipLevels(1)
+                     .setArrayLayers(1)
+                     .setSamples(vk::SampleCountFlagBits::e1)
+                     .setTiling(vk::ImageTiling::eOptimal)
+                     .setUsage(vk::ImageUsageFlagBits::eSampled |
+                               vk::ImageUsageFlagBits::eTransferDst |
+                               vk::ImageUsageFlagBits::eTransferSrc)
+                     .setSharingMode(vk::SharingMode::eExclusive)
+                     .setInitialLayout(vk::ImageLayout::eUndefined);
+  vk::Image image{};
+  if (device().createImage(&imageCI, nullptr, &image) !=
+      vk::Result::eSuccess) {
+    return false;
+  }
+  device().bindImageMemory(image, dst.memory(), dst.offset);
+
+  auto view = CreateView(image);
+  if (!view) {
+    device().destroy(image);
+    return false;
+  }
+
+  auto range =
+      vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1);
+  vk::ImageMemoryBarrier toTransfer[2] = {
+      vk::ImageMemoryBarrier()
+          .setOldLayout(vk::ImageLayout::eShaderReadOnlyOptimal)
+          .setNewLayout(vk::ImageLayout::eTransferSrcOptimal)
+          .setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+          .setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+          .setImage(image_)
+          .setSubresourceRange(range)
+          .setSrcAccessMask(vk::AccessFlagBits::eShaderRead)
+          .setDstAccessMask(vk::AccessFlagBits::eTransferRead),
+      vk::ImageMemoryBarrier()
+          .setOldLayout(vk::ImageLayout::eUndefined)
+          .setNewLayout(vk::ImageLayout::eTransferDstOptimal)
+          .setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+          .setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+          .setImage(image)
+          .setSubresourceRange(range)
+          .setSrcAccessMask((vk::AccessFlags)0)
+          .setDstAccessMask(vk::AccessFlagBits::eTransferWrite)};
+  cmd.pipelineBarrier(vk::PipelineStageFlagBits::eFragmentShader |
+                          vk::PipelineStageFlagBits::eVertexShader,
+                      vk::PipelineStageFlagBits::eTransfer,
+                      (vk::DependencyFlagBits)0, 0, nullptr, 0, nullptr, 2,
+                      toTransfer);
+
+  auto layers =
+      vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, 0, 0, 1);
+  auto region = vk::ImageCopy()
+                    .setSrcSubresource(layers)
+                    .setDstSubresource(layers)
+                    .setExtent(vk::Extent3D{width_, height_, 1});
+  cmd.copyImage(image_, vk::ImageLayout::eTransferSrcOptimal, image,
+                vk::ImageLayout::eTransferDstOptimal, 1, &region);
+
+  // The old image goes back too, the frame may still sample it through
+  // descriptors that have not been rewritten yet.
+  vk::ImageMemoryBarrier toShader[2] = {
+      vk::ImageMemoryBarrier()
+          .setOldLayout(vk::ImageLayout::eTransferDstOptimal)
+          .setNewLayout(vk::ImageLayout::eShaderReadOnlyOptimal)
+          .setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+          .setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+          .setImage(image)
+          .setSubresourceRange(range)
+          .setSrcAccessMask(vk::AccessFlagBits::eTransferWrite)
+          .setDstAccessMask(vk::AccessFlagBits::eShaderRead),
+      vk::ImageMemoryBarrier()
+          .setOldLayout(vk::ImageLayout::eTransferSrcOptimal)
+          .setNewLayout(vk::ImageLayout::eShaderReadOnlyOptimal)
+          .setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+          .setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+          .setImage(image_)
+          .setSubresourceRange(range)
+          .setSrcAccessMask((vk::AccessFlags)0)
+          .setDstAccessMask(vk::AccessFlagBits::eShaderRead)};
+  cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+                      vk::PipelineStageFlagBits::eFragmentShader |
+                          vk::PipelineStageFlagBits::eVertexShader,
+                      (vk::DependencyFlagBits)0, 0, nullptr, 0, nullptr, 2,
+                      toShader);
+
+  Release(view_);
+  Release(image_);
+  Release(memory_);
+  image_ = image;
+  view_ = view;
+  memory_ = dst;
+  revision_++;
+  if (bindless_index_ != UINT32_MAX) {
+    bindless()->Write(bindless_index_, view_, sampler_);
+  }
   return true;
 }
+
+static const vk::PipelineStageFlags kStorageStages =
+    vk::PipelineStageFlagBits::eVertexShader |
+    vk::PipelineStageFlagBits::eFragmentShader |
+    vk::PipelineStageFlagBits::eComputeShader;
+static const vk::AccessFlags kStorageAccess =
+    vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite;
+
+StorageImage::StorageImage(Device* parent) : DeviceResource(parent) {}
+
+StorageImage::~StorageImage() {
+  Release(view_);
+  Release(image_);
+  Release(memory_);
+}
+
+bool StorageImage::SetImage2D(vk::Format format, uint32_t width,
+                              uint32_t height, uint32_t texel_size,
+                              const void* data) {
+  Release(view_);
+  Release(image_);
+  Release(memory_);
+  revision_++;
+
+  format_ = format;
+  width_ = width;
+  height_ = height;
+  texel_size_ = texel_size;
+
+  auto prop = gpu().getFormatProperties(format_);
+  if (!(prop.optimalTilingFeatures &
+        vk::FormatFeatureFlagBits::eStorageImage)) {
+    return false;
+  }
+
+  auto imageCI = vk::ImageCreateInfo()
+                     .setImageType(vk::ImageType::e2D)
+                     .setFormat(format_)
+                     .setExtent({width, height, 1})
+                     .setMipLevels(1)
+                     .setArrayLayers(1)
+                     .setSamples(vk::SampleCountFlagBits::e1)
+                     .setTiling(vk::ImageTiling::eOptimal)
+                     .setUsage(vk::ImageUsageFlagBits::eStorage |
+                               vk::ImageUsageFlagBits::eTransferDst |
+                               vk::ImageUsageFlagBits::eTransferSrc)
+                     .setSharingMode(vk::SharingMode::eExclusive)
+                     .setInitialLayout(vk::ImageLayout::eUndefined);
+  image_ = device().createImage(imageCI);
+  if (!image_) {
+    return false;
+  }
+
+  // Not relocatable, the defragmenter only knows sampled layouts.
+  memory_ = CreateMemory(device().getImageMemoryRequirements(image_),
+                         vk::MemoryPropertyFlagBits::eDeviceLocal,
+                         MemoryClass::kStorageImage);
+  if (!memory_) {
+    return false;
+  }
+  device().bindImageMemory(image_, memory_.memory(), memory_.offset);
+
+  auto imageViewCI = vk::ImageViewCreateInfo()
+                         .setImage(image_)
+                         .setViewType(vk::ImageViewType::e2D)
+                         .setFormat(format_)
+                         .setSubresourceRange(vk::ImageSubresourceRange(
+                             vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1));
+  view_ = device().createImageView(imageViewCI);
+  if (!view_) {
+    return false;
+  }
+
+  return Write(data, vk::ImageLayout::eUndefined);
+}
+
+bool StorageImage::Upload(const void* data, size_t size) {
+  if (!image_ || !data || size != this->size()) {
+    return false;
+  }
+  return Write(data, vk::ImageLayout::eGeneral);
+}
+
+bool StorageImage::Write(const void* data, vk::ImageLayout oldLayout) {
+  std::unique_ptr<StageBuffer> stageBuffer{};
+  if (data) {
+    stageBuffer = CreateStageBuffer(data, size());
+  }
+  auto cmd = BeginOnceCmd();
+  if (!cmd) {
+    return false;
+  }
+
+  auto range =
+      vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1);
+  auto toTransfer = vk::ImageMemoryBarrier()
+                        .setOldLayout(oldLayout)
+                        .setNewLayout(vk::ImageLayout::eGeneral)
+                        .setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+                        .setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+                        .setImage(image_)
+                        .setSubresourceRange(range)
+                        .setSrcAccessMask(kStorageAccess)
+                        .setDstAccessMask(vk::AccessFlagBits::eTransferWrite);
+  cmd.pipelineBarrier(kStorageStages, vk::PipelineStageFlagBits::eTransfer,
+                      (vk::DependencyFlagBits)0, 0, nullptr, 0, nullptr, 1,
+                      &toTransfer);
+
+  if (stageBuffer) {
+    auto region = vk::BufferImageCopy()
+                      .setImageSubresource(vk::ImageSubresourceLayers{
+                          vk::ImageAspectFlagBits::eColor, 0, 0, 1})
+                      .setImageExtent(vk::Extent3D{width_, height_, 1});
+    cmd.copyBufferToImage(stageBuffer->buffer(), image_,
+                          vk::ImageLayout::eGeneral, 1, &region);
+  } else {
+    auto color = vk::ClearColorValue(std::array<uint32_t, 4>{0, 0, 0, 0});
+    cmd.clearColorImage(image_, vk::ImageLayout::eGeneral, &color, 1,
+                        &range);
+  }
+
+  auto toShader = toTransfer;
+  toShader.setOldLayout(vk::ImageLayout::eGeneral)
+      .setSrcAccessMask(vk::AccessFlagBits::eTransferWrite)
+      .setDstAccessMask(kStorageAccess);
+  cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, kStorageStages,
+                      (vk::DependencyFlagBits)0, 0, nullptr, 0, nullptr, 1,
+                      &toShader);
+  EndOnceCmd(cmd);
+  return true;
+}
+
+bool StorageImage::Readback(void* data, size_t size) const {
+  if (!image_ || size != this->size()) {
+    return false;
+  }
+  const auto& image = image_;
+  auto extent = vk::Extent3D{width_, height_, 1};
+  return CopyToHost(
+      [&image, extent](const vk::CommandBuffer& cmd, const vk::Buffer& dst) {
+        auto region = vk::BufferImageCopy()
+                          .setImageSubresource(vk::ImageSubresourceLayers{
+                              vk::ImageAspectFlagBits::eColor, 0, 0, 1})
+                          .setImageExtent(extent);
+        cmd.copyImageToBuffer(image, vk::ImageLayout::eGeneral, dst, 1,
+                              &region);
+      },
+      data, size);
+}
 } // namespace impl
 } // namespace VPP
\ No newline at end of file
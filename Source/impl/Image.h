@@ -6,7 +6,7 @@
 
 namespace VPP {
 namespace impl {
-class SamplerTexture : public DeviceResource {
+class SamplerTexture : public DeviceResource, public Relocatable {
 public:
   SamplerTexture(Device* parent);
   ~SamplerTexture();
@@ -16,16 +16,65 @@ public:
 
   const vk::ImageView& view() const { return view_; }
   const vk::Sampler& sampler() const { return sampler_; }
+  // Changes whenever view() is replaced, descriptors must be rewritten.
+  uint32_t revision() const { return revision_; }
+  // Stable slot in the device's bindless table, UINT32_MAX without one.
+  uint32_t bindless_index() const { return bindless_index_; }
 
 private:
+  bool Relocate(const vk::CommandBuffer& cmd, const Allocation& dst) override;
+  vk::ImageView CreateView(const vk::Image& image) const;
+
   vk::Format format_ = vk::Format::eUndefined;
   uint32_t width_ = 0;
   uint32_t height_ = 0;
 
   vk::Image image_{};
   vk::ImageView view_{};
-  vk::DeviceMemory memory_{};
+  Allocation memory_{};
   vk::Sampler sampler_{};
+  uint32_t revision_ = 0;
+  uint32_t bindless_index_ = UINT32_MAX;
+};
+
+// Device local 2D image for imageLoad/imageStore. It stays in eGeneral
+// layout for its whole life, so compute and graphics only need memory
+// barriers between them.
+class StorageImage : public DeviceResource {
+public:
+  StorageImage(Device* parent);
+  ~StorageImage();
+
+  // texel_size is in bytes, the image starts zeroed when data is null.
+  bool SetImage2D(vk::Format format, uint32_t width, uint32_t height,
+                  uint32_t texel_size, const void* data = nullptr);
+  // Whole image, tightly packed rows. Both wait for the GPU, ordered after
+  // every earlier shader access.
+  bool Upload(const void* data, size_t size);
+  bool Readback(void* data, size_t size) const;
+
+  const vk::Image& image() const { return image_; }
+  const vk::ImageView& view() const { return view_; }
+  uint32_t width() const { return width_; }
+  uint32_t height() const { return height_; }
+  size_t size() const { return (size_t)width_ * height_ * texel_size_; }
+  // Changes whenever view() is replaced, descriptors must be rewritten.
+  uint32_t revision() const { return revision_; }
+
+private:
+  // Copies data in, or clears when it is null, moving from oldLayout to
+  // eGeneral.
+  bool Write(const void* data, vk::ImageLayout oldLayout);
+
+  vk::Format format_ = vk::Format::eUndefined;
+  uint32_t width_ = 0;
+  uint32_t height_ = 0;
+  uint32_t texel_size_ = 0;
+
+  vk::Image image_{};
+  vk::ImageView view_{};
+  Allocation memory_{};
+  uint32_t revision_ = 0;
 };
 } // namespace impl
 } // namespace VPP
\ No newline at end of file
@@ -0,0 +1,313 @@
+#include "Memory.h"
+
+#include <algorithm>
+
+namespace VPP {
+namespace impl {
+
+static const vk::DeviceSize kBlockSize = 64ull << 20;
+
+static bool IsLinear(MemoryClass cls) {
+  return cls != MemoryClass::kTexture && cls != MemoryClass::kDepth &&
+         cls != MemoryClass::kStorageImage;
+}
+
+const char* GetClassName(MemoryClass cls) {
+  switch (cls) {
+  case MemoryClass::kVertex:
+    return "vertex";
+  case MemoryClass::kIndex:
+    return "index";
+  case MemoryClass::kUniform:
+    return "uniform";
+  case MemoryClass::kTexture:
+    return "texture";
+  case MemoryClass::kStaging:
+    return "staging";
+  case MemoryClass::kDepth:
+    return "depth";
+  case MemoryClass::kStorage:
+    return "storage";
+  case MemoryClass::kStorageImage:
+    return "storage_image";
+  default:
+    break;
+  }
+  return "other";
+}
+
+vk::DeviceMemory Allocation::memory() const {
+  return block ? block->memory() : vk::DeviceMemory();
+}
+
+MemoryBlock::MemoryBlock(vk::DeviceMemory memory, vk::DeviceSize size,
+                         uint32_t typeIndex, bool linear, bool dedicated)
+    : memory_(memory), size_(size), type_index_(typeIndex), linear_(linear),
+      dedicated_(dedicated) {
+  if (!dedicated_) {
+    free_ranges_[0] = size_;
+  }
+}
+
+bool MemoryBlock::Allocate(vk::DeviceSize size, vk::DeviceSize alignment,
+                           vk::DeviceSize& offset) {
+  alignment = std::max<vk::DeviceSize>(alignment, 1);
+  for (auto iter = free_ranges_.begin(); iter != free_ranges_.end(); ++iter) {
+    auto rangeBegin = iter->first;
+    auto rangeEnd = iter->first + iter->second;
+    auto begin = (rangeBegin + alignment - 1) / alignment * alignment;
+    if (begin + size > rangeEnd) {
+      continue;
+    }
+
+    free_ranges_.erase(iter);
+    if (begin > rangeBegin) {
+      free_ranges_[rangeBegin] = begin - rangeBegin;
+    }
+    if (begin + size < rangeEnd) {
+      free_ranges_[begin + size] = rangeEnd - (begin + size);
+    }
+    used_ += size;
+    offset = begin;
+    return true;
+  }
+
+  return false;
+}
+
+void MemoryBlock::Free(vk::DeviceSize offset, vk::DeviceSize size) {
+  used_ -= size;
+  owners_.erase(offset);
+
+  auto iter = free_ranges_.emplace(offset, size).first;
+  auto next = std::next(iter);
+  if (next != free_ranges_.end() && iter->first + iter->second == next->first) {
+    iter->second += next->second;
+    free_ranges_.erase(next);
+  }
+  if (iter != free_ranges_.begin()) {
+    auto prev = std::prev(iter);
+    if (prev->first + prev->second == iter->first) {
+      prev->second += iter->second;
+      free_ranges_.erase(iter);
+    }
+  }
+}
+
+MemoryAllocator::MemoryAllocator(const vk::Device& device) : device_(device) {}
+
+MemoryAllocator::~MemoryAllocator() {
+  for (auto& e : blocks_) {
+    device_.free(e->memory_);
+  }
+  blocks_.clear();
+}
+
+void MemoryAllocator::EndFrame() {
+  stats_.frame_allocs = frame_allocs_;
+  stats_.frame_bytes = frame_bytes_;
+  frame_allocs_ = 0;
+  frame_bytes_ = 0;
+}
+
+void MemoryAllocator::Track(const Allocation& alloc, bool add,
+                            bool relocated) {
+  auto& type = stats_.types[alloc.block->type_index_];
+  auto& cls = stats_.classes[(size_t)alloc.cls];
+  if (add) {
+    type.used += alloc.size;
+    cls.count++;
+    cls.bytes += alloc.size;
+    stats_.used += alloc.size;
+    stats_.peak_used = std::max(stats_.peak_used, stats_.used);
+    if (relocated) {
+      stats_.total_relocations++;
+      return;
+    }
+    stats_.total_allocs++;
+    frame_allocs_++;
+    frame_bytes_ += alloc.size;
+  } else {
+    type.used -= alloc.size;
+    cls.count--;
+    cls.bytes -= alloc.size;
+    stats_.used -= alloc.size;
+  }
+}
+
+MemoryBlock* MemoryAllocator::CreateBlock(vk::DeviceSize size,
+                                          uint32_t typeIndex, bool linear,
+                                          bool dedicated) {
+  auto memoryAI =
+      vk::MemoryAllocateInfo().setAllocationSize(size).setMemoryTypeIndex(
+          typeIndex);
+  vk::DeviceMemory memory{};
+  if (device_.allocateMemory(&memoryAI, nullptr, &memory) !=
+      vk::Result::eSuccess) {
+    return nullptr;
+  }
+  blocks_.emplace_back(
+      std::make_unique<MemoryBlock>(memory, size, typeIndex, linear, dedicated));
+
+  auto& type = stats_.types[typeIndex];
+  type.reserved += size;
+  type.blocks++;
+  stats_.reserved += size;
+  stats_.peak_reserved = std::max(stats_.peak_reserved, stats_.reserved);
+  return blocks_.back().get();
+}
+
+void MemoryAllocator::DestroyBlock(MemoryBlock& block) {
+  auto& type = stats_.types[block.type_index_];
+  type.reserved -= block.size_;
+  type.blocks--;
+  stats_.reserved -= block.size_;
+  device_.free(block.memory_);
+}
+
+Allocation MemoryAllocator::Allocate(const vk::MemoryRequirements& req,
+                                     uint32_t typeIndex, MemoryClass cls,
+                                     bool dedicated, Relocatable* owner) {
+  Allocation alloc{};
+  alloc.cls = cls;
+  bool linear = IsLinear(cls);
+  if (dedicated || req.size > kBlockSize / 2) {
+    if (auto* block = CreateBlock(req.size, typeIndex, linear, true)) {
+      block->used_ = req.size;
+      alloc.block = block;
+      alloc.size = req.size;
+      Track(alloc, true);
+    }
+    return alloc;
+  }
+
+  vk::DeviceSize offset = 0;
+  for (auto& e : blocks_) {
+    if (e->dedicated_ || e->type_index_ != typeIndex || e->linear_ != linear) {
+      continue;
+    }
+    if (e->Allocate(req.size, req.alignment, offset)) {
+      alloc.block = e.get();
+      break;
+    }
+  }
+  if (!alloc) {
+    auto* block = CreateBlock(kBlockSize, typeIndex, linear, false);
+    if (!block || !block->Allocate(req.size, req.alignment, offset)) {
+      return alloc;
+    }
+    alloc.block = block;
+  }
+  alloc.offset = offset;
+  alloc.size = req.size;
+  Track(alloc, true);
+
+  if (owner) {
+    auto& record = alloc.block->owners_[offset];
+    record.owner = owner;
+    record.size = req.size;
+    record.alignment = req.alignment;
+    record.cls = cls;
+  }
+  return alloc;
+}
+
+void MemoryAllocator::Free(const Allocation& alloc) {
+  if (!alloc) {
+    return;
+  }
+  Track(alloc, false);
+  auto* block = alloc.block;
+  if (!block->dedicated_) {
+    block->Free(alloc.offset, alloc.size);
+    return;
+  }
+
+  auto iter = std::find_if(
+      blocks_.begin(), blocks_.end(),
+      [block](const std::unique_ptr<MemoryBlock>& e) { return e.get() == block; });
+  if (iter != blocks_.end()) {
+    DestroyBlock(*block);
+    blocks_.erase(iter);
+  }
+}
+
+void MemoryAllocator::Disown(const Allocation& alloc) {
+  if (alloc && !alloc.block->dedicated_) {
+    alloc.block->owners_.erase(alloc.offset);
+  }
+}
+
+void MemoryAllocator::ReleaseEmptyBlocks() {
+  auto iter = std::remove_if(
+      blocks_.begin(), blocks_.end(), [this](std::unique_ptr<MemoryBlock>& e) {
+        if (e->dedicated_ || e->used_ != 0) {
+          return false;
+        }
+        DestroyBlock(*e);
+        return true;
+      });
+  blocks_.erase(iter, blocks_.end());
+}
+
+vk::DeviceSize MemoryAllocator::Defragment(const vk::CommandBuffer& cmd,
+                                           vk::DeviceSize budget) {
+  std::map<std::pair<uint32_t, bool>, std::vector<MemoryBlock*>> pools{};
+  for (auto& e : blocks_) {
+    if (!e->dedicated_) {
+      pools[std::make_pair(e->type_index_, e->linear_)].push_back(e.get());
+    }
+  }
+
+  vk::DeviceSize moved = 0;
+  for (auto& pool : pools) {
+    auto& blocks = pool.second;
+    if (blocks.size() < 2) {
+      continue;
+    }
+    std::sort(blocks.begin(), blocks.end(),
+              [](const MemoryBlock* left, const MemoryBlock* right) {
+                return left->used_ > right->used_;
+              });
+
+    auto* source = blocks.back();
+    auto owners = source->owners_;
+    for (const auto& e : owners) {
+      const auto& record = e.second;
+      if (moved + record.size > budget) {
+        continue;
+      }
+
+      Allocation dst{};
+      dst.cls = record.cls;
+      vk::DeviceSize offset = 0;
+      for (size_t i = 0; i + 1 < blocks.size(); i++) {
+        if (blocks[i]->Allocate(record.size, record.alignment, offset)) {
+          dst.block = blocks[i];
+          dst.offset = offset;
+          dst.size = record.size;
+          break;
+        }
+      }
+      if (!dst) {
+        break;
+      }
+
+      if (!record.owner->Relocate(cmd, dst)) {
+        dst.block->Free(dst.offset, dst.size);
+        continue;
+      }
+      // The source range itself is returned later through the owner's
+      // deferred release, once the copy has executed.
+      source->owners_.erase(e.first);
+      dst.block->owners_[dst.offset] = record;
+      Track(dst, true, true);
+      moved += record.size;
+    }
+  }
+
+  return moved;
+}
+
+} // namespace impl
+} // namespace VPP
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include <map>
+#include <memory>
+#include <vector>
+
+namespace VPP {
+namespace impl {
+
+class MemoryBlock;
+
+enum class MemoryClass {
+  kVertex,
+  kIndex,
+  kUniform,
+  kTexture,
+  kStaging,
+  kDepth,
+  kStorage,
+  kStorageImage,
+  kOther,
+  kCount,
+};
+
+const char* GetClassName(MemoryClass cls);
+
+struct Allocation {
+  MemoryBlock* block = nullptr;
+  vk::DeviceSize offset = 0;
+  vk::DeviceSize size = 0;
+  MemoryClass cls = MemoryClass::kOther;
+
+  vk::DeviceMemory memory() const;
+  explicit operator bool() const { return block != nullptr; }
+};
+
+struct MemoryStats {
+  struct Type {
+    vk::DeviceSize reserved = 0;
+    vk::DeviceSize used = 0;
+    uint32_t blocks = 0;
+  };
+  struct Class {
+    uint32_t count = 0;
+    vk::DeviceSize bytes = 0;
+  };
+
+  Type types[VK_MAX_MEMORY_TYPES]{};
+  // Filled from the types by Device, the allocator does not know the heaps.
+  Type heaps[VK_MAX_MEMORY_HEAPS]{};
+  Class classes[(size_t)MemoryClass::kCount]{};
+  vk::DeviceSize reserved = 0;
+  vk::DeviceSize used = 0;
+  vk::DeviceSize peak_reserved = 0;
+  vk::DeviceSize peak_used = 0;
+  uint64_t total_allocs = 0;
+  // Moves made by Defragment, not counted as allocations.
+  uint64_t total_relocations = 0;
+  // Allocations made during the last finished frame.
+  uint32_t frame_allocs = 0;
+  vk::DeviceSize frame_bytes = 0;
+};
+
+class Relocatable {
+public:
+  // Records a copy of the current contents into dst and switches to it.
+  virtual bool Relocate(const vk::CommandBuffer& cmd, const Allocation& dst) = 0;
+
+protected:
+  ~Relocatable() = default;
+};
+
+class MemoryBlock {
+  friend class MemoryAllocator;
+
+public:
+  MemoryBlock(vk::DeviceMemory memory, vk::DeviceSize size, uint32_t typeIndex,
+              bool linear, bool dedicated);
+
+  const vk::DeviceMemory& memory() const { return memory_; }
+  vk::DeviceSize size() const { return size_; }
+  vk::DeviceSize used() const { return used_; }
+  uint32_t type_index() const { return type_index_; }
+  bool dedicated() const { return dedicated_; }
+
+private:
+  struct Owner {
+    Relocatable* owner = nullptr;
+    vk::DeviceSize size = 0;
+    vk::DeviceSize alignment = 1;
+    MemoryClass cls = MemoryClass::kOther;
+  };
+
+  bool Allocate(vk::DeviceSize size, vk::DeviceSize alignment,
+                vk::DeviceSize& offset);
+  void Free(vk::DeviceSize offset, vk::DeviceSize size);
+
+  vk::DeviceMemory memory_{};
+  vk::DeviceSize size_ = 0;
+  vk::DeviceSize used_ = 0;
+  uint32_t type_index_ = 0;
+  bool linear_ = true;
+  bool dedicated_ = false;
+  std::map<vk::DeviceSize, vk::DeviceSize> free_ranges_{};
+  std::map<vk::DeviceSize, Owner> owners_{};
+};
+
+class MemoryAllocator {
+public:
+  MemoryAllocator(const vk::Device& device);
+  ~MemoryAllocator();
+
+  Allocation Allocate(const vk::MemoryRequirements& req, uint32_t typeIndex,
+                      MemoryClass cls, bool dedicated, Relocatable* owner);
+  void Free(const Allocation& alloc);
+  // Stops Defragment from moving the allocation, call as soon as the owner
+  // lets go of it even if the range itself is freed later.
+  void Disown(const Allocation& alloc);
+  void ReleaseEmptyBlocks();
+
+  const MemoryStats& stats() const { return stats_; }
+  void EndFrame();
+
+  // Moves live allocations out of the sparsest block of each pool into
+  // fuller ones, copying at most budget bytes. Returns the bytes moved.
+  vk::DeviceSize Defragment(const vk::CommandBuffer& cmd,
+                            vk::DeviceSize budget);
+
+private:
+  MemoryBlock* CreateBlock(vk::DeviceSize size, uint32_t typeIndex,
+                           bool linear, bool dedicated);
+  void DestroyBlock(MemoryBlock& block);
+  void Track(const Allocation& alloc, bool add, bool relocated = false);
+
+  vk::Device device_{};
+  std::vector<std::unique_ptr<MemoryBlock>> blocks_{};
+  MemoryStats stats_{};
+  uint32_t frame_allocs_ = 0;
+  vk::DeviceSize frame_bytes_ = 0;
+};
+
+} // namespace impl
+} // namespace VPP
@@ -0,0 +1,42 @@
+#include "ObjectCache.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace VPP {
+namespace impl {
+
+static const uint64_t kFnvPrime = 1099511628211ull;
+
+static uint64_t Mix(uint64_t hash, uint32_t value) {
+  for (int i = 0; i < 4; i++) {
+    hash ^= (value >> (i * 8)) & 0xff;
+    hash *= kFnvPrime;
+  }
+  return hash;
+}
+
+uint64_t HashWords(const uint32_t* words, size_t count) {
+  uint64_t hash = 14695981039346656037ull;
+  for (size_t i = 0; i < count; i++) {
+    hash = Mix(hash, words[i]);
+  }
+  return hash;
+}
+
+void CacheKey::Add(uint32_t value) {
+  words_.push_back(value);
+  hash_ = Mix(hash_, value);
+}
+
+void CacheKey::Add(const void* data, size_t size) {
+  const auto* bytes = (const uint8_t*)data;
+  for (size_t i = 0; i < size; i += 4) {
+    uint32_t value = 0;
+    memcpy(&value, bytes + i, std::min<size_t>(4, size - i));
+    Add(value);
+  }
+}
+
+} // namespace impl
+} // namespace VPP
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include <map>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace VPP {
+namespace impl {
+
+// Flattened description of a Vulkan object, compared word by word so a
+// hash collision between keys never shares an object. Shaders only enter
+// keys as their size and 64-bit FNV hash though, so shader identity is
+// hash based: two SPIR-V modules that collide would share pipelines.
+class CacheKey {
+public:
+  void Add(uint32_t value);
+  void Add(const void* data, size_t size);
+  template <typename T> void AddHandle(const T& handle) {
+    auto value = (uint64_t)static_cast<typename T::CType>(handle);
+    Add((uint32_t)value);
+    Add((uint32_t)(value >> 32));
+  }
+
+  uint64_t hash() const { return hash_; }
+  bool operator==(const CacheKey& other) const {
+    return hash_ == other.hash_ && words_ == other.words_;
+  }
+
+private:
+  std::vector<uint32_t> words_{};
+  uint64_t hash_ = 14695981039346656037ull;
+};
+
+// 64-bit FNV-1a, stable across runs and platforms.
+uint64_t HashWords(const uint32_t* words, size_t count);
+
+struct CacheKeyHash {
+  size_t operator()(const CacheKey& key) const { return (size_t)key.hash(); }
+};
+
+// Reference counted handles shared between identical requests, safe to use
+// from pipeline compile workers.
+template <typename T> class HandleCache {
+public:
+  // Returns the shared handle with a new reference, null when not cached.
+  T Acquire(const CacheKey& key) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto iter = entries_.find(key);
+    if (iter == entries_.end()) {
+      return T();
+    }
+    iter->second.refs++;
+    return iter->second.handle;
+  }
+
+  // Adds handle under key unless another thread got there first. Returns
+  // the handle now cached with a reference for the caller; when it is not
+  // the one passed in, the caller destroys its own.
+  T InsertOrAcquire(const CacheKey& key, const T& handle) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& entry = entries_[key];
+    if (entry.refs > 0) {
+      entry.refs++;
+      return entry.handle;
+    }
+    entry.handle = handle;
+    entry.refs = 1;
+    keys_[static_cast<typename T::CType>(handle)] = key;
+    return handle;
+  }
+
+  // Drops a reference, true when the caller held the last one and has to
+  // destroy the handle. Handles never inserted are always the caller's.
+  bool Release(const T& handle) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto key = keys_.find(static_cast<typename T::CType>(handle));
+    if (key == keys_.end()) {
+      return true;
+    }
+    auto iter = entries_.find(key->second);
+    if (--iter->second.refs > 0) {
+      return false;
+    }
+    entries_.erase(iter);
+    keys_.erase(key);
+    return true;
+  }
+
+  size_t size() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return entries_.size();
+  }
+
+private:
+  struct Entry {
+    T handle{};
+    uint32_t refs = 0;
+  };
+
+  std::unordered_map<CacheKey, Entry, CacheKeyHash> entries_{};
+  std::map<typename T::CType, CacheKey> keys_{};
+  mutable std::mutex mutex_{};
+};
+
+struct ObjectCache {
+  HandleCache<vk::DescriptorSetLayout> set_layouts{};
+  HandleCache<vk::PipelineLayout> pipeline_layouts{};
+  HandleCache<vk::Pipeline> pipelines{};
+  // Graphics pipeline library parts, shared across the pipelines using them.
+  HandleCache<vk::Pipeline> libraries{};
+};
+
+} // namespace impl
+} // namespace VPP
@@ -1,91 +1,279 @@
 #include "Pipeline.h"
 #include "Buffer.h"
+#include "Descriptor.h"
 
+#include <algorithm>
+#include <cstring>
 #include <map>
 
 namespace VPP {
 
 namespace impl {
 
-Pipeline::Pipeline(Device* parent) : DeviceResource(parent) {}
-
-Pipeline::~Pipeline() {
-  if (pipeline_) {
-    device().destroy(pipeline_);
-  }
-  if (pipe_layout_) {
-    device().destroy(pipe_layout_);
-  }
-  if (descriptor_pool_) {
-    device().destroy(descriptor_pool_);
+static uint32_t GetTopologyClass(vk::PrimitiveTopology topology) {
+  switch (topology) {
+  case vk::PrimitiveTopology::ePointList:
+    return 0;
+  case vk::PrimitiveTopology::eLineList:
+  case vk::PrimitiveTopology::eLineStrip:
+  case vk::PrimitiveTopology::eLineListWithAdjacency:
+  case vk::PrimitiveTopology::eLineStripWithAdjacency:
+    return 1;
+  case vk::PrimitiveTopology::ePatchList:
+    return 3;
+  default:
+    break;
   }
-  for (auto& e : desc_layout_) {
-    if (e) {
-      device().destroy(e);
-    }
-  }
-  for (auto& e : shaders_) {
-    if (e.shader) {
-      device().destroy(e.shader);
-    }
+  return 2;
+}
+
+bool PipelineBase::SetBindless(uint32_t set) {
+  if (!bindless()) {
+    return false;
   }
+  bindless_set_ = set;
+  return true;
 }
 
-bool Pipeline::SetShader(const glsl::MetaData& data) {
+bool PipelineBase::CreateLayout(const glsl::MetaData& data) {
   std::map<uint32_t, std::vector<const glsl::Uniform*>> dataMap{};
-  std::map<vk::DescriptorType, uint32_t> poolMap{};
   for (const auto& e : data.uniforms) {
     dataMap[e.set].push_back(&e);
-    poolMap[e.type] += e.count;
+  }
+  if (bindless_set_ != UINT32_MAX) {
+    dataMap[bindless_set_].clear();
+  }
+  // Sets are numbered by position, a set the shaders skip gets an empty
+  // layout.
+  if (!dataMap.empty()) {
+    for (uint32_t i = 0; i < dataMap.rbegin()->first; i++) {
+      dataMap[i];
+    }
   }
 
   for (const auto& e : dataMap) {
+    if (e.first == bindless_set_) {
+      desc_layout_.push_back(bindless()->layout());
+      update_templates_.emplace_back();
+      update_sizes_.push_back(0);
+      continue;
+    }
+
     std::vector<vk::DescriptorSetLayoutBinding> bindings{};
     bindings.reserve(e.second.size());
     for (const auto* e : e.second) {
       bindings.emplace_back(*e);
     }
-    auto info = vk::DescriptorSetLayoutCreateInfo().setBindings(bindings);
-    desc_layout_.emplace_back(device().createDescriptorSetLayout(info));
-    if (!desc_layout_.back()) {
+    CacheKey layoutKey{};
+    for (const auto& binding : bindings) {
+      layoutKey.Add(binding.binding);
+      layoutKey.Add((uint32_t)binding.descriptorType);
+      layoutKey.Add(binding.descriptorCount);
+      layoutKey.Add((uint32_t)binding.stageFlags);
+    }
+    auto layout = objects().set_layouts.Acquire(layoutKey);
+    if (!layout) {
+      auto info = vk::DescriptorSetLayoutCreateInfo().setBindings(bindings);
+      auto created = device().createDescriptorSetLayout(info);
+      if (!created) {
+        return false;
+      }
+      layout = objects().set_layouts.InsertOrAcquire(layoutKey, created);
+      if (layout != created) {
+        device().destroy(created);
+      }
+    }
+    desc_layout_.emplace_back(layout);
+    if (bindings.empty()) {
+      update_templates_.emplace_back();
+      update_sizes_.push_back(0);
+      continue;
+    }
+
+    // The whole set is written from DescriptorInfo entries packed in
+    // binding order, array elements next to each other.
+    std::vector<vk::DescriptorUpdateTemplateEntry> entries{};
+    uint32_t count = 0;
+    for (const auto* e : e.second) {
+      entries.emplace_back(vk::DescriptorUpdateTemplateEntry()
+                               .setDstBinding(e->binding)
+                               .setDstArrayElement(0)
+                               .setDescriptorCount(e->count)
+                               .setDescriptorType(e->type)
+                               .setOffset(count * sizeof(DescriptorInfo))
+                               .setStride(sizeof(DescriptorInfo)));
+      count += e->count;
+    }
+    auto templateCI =
+        vk::DescriptorUpdateTemplateCreateInfo()
+            .setDescriptorUpdateEntries(entries)
+            .setTemplateType(vk::DescriptorUpdateTemplateType::eDescriptorSet)
+            .setDescriptorSetLayout(desc_layout_.back());
+    update_templates_.emplace_back(
+        device().createDescriptorUpdateTemplate(templateCI));
+    update_sizes_.push_back(count);
+    if (!update_templates_.back()) {
       return false;
     }
   }
-  std::vector<vk::PushConstantRange> pushRanges{};
+  push_ranges_.clear();
   for (const auto& e : data.pushes) {
-    pushRanges.emplace_back(e);
+    push_ranges_.emplace_back(e);
   }
-  auto layoutCI = vk::PipelineLayoutCreateInfo()
-                      .setSetLayouts(desc_layout_)
-                      .setPushConstantRanges(pushRanges);
-  pipe_layout_ = device().createPipelineLayout(layoutCI);
-  if (!pipe_layout_) {
-    return false;
+  std::vector<uint32_t> bounds{};
+  for (const auto& e : push_ranges_) {
+    bounds.push_back(e.offset);
+    bounds.push_back(e.offset + e.size);
   }
-
-  if (!poolMap.empty()) {
-    std::vector<vk::DescriptorPoolSize> poolSizes{};
-    for (const auto& e : poolMap) {
-      poolSizes.emplace_back(
-          vk::DescriptorPoolSize().setType(e.first).setDescriptorCount(
-              e.second));
+  std::sort(bounds.begin(), bounds.end());
+  bounds.erase(std::unique(bounds.begin(), bounds.end()), bounds.end());
+  push_spans_.clear();
+  for (size_t i = 0; i + 1 < bounds.size(); i++) {
+    vk::ShaderStageFlags stages{};
+    for (const auto& e : push_ranges_) {
+      if (e.offset <= bounds[i] && bounds[i + 1] <= e.offset + e.size) {
+        stages |= e.stageFlags;
+      }
+    }
+    if (!stages) {
+      continue;
     }
-    auto poolCI = vk::DescriptorPoolCreateInfo()
-                      .setMaxSets((uint32_t)dataMap.size())
-                      .setPoolSizes(poolSizes);
-    descriptor_pool_ = device().createDescriptorPool(poolCI);
-    if (!descriptor_pool_) {
+    auto& spans = push_spans_;
+    if (!spans.empty() && spans.back().stageFlags == stages &&
+        spans.back().offset + spans.back().size == bounds[i]) {
+      spans.back().size += bounds[i + 1] - bounds[i];
+    } else {
+      spans.emplace_back(stages, bounds[i], bounds[i + 1] - bounds[i]);
+    }
+  }
+  CacheKey layoutKey{};
+  for (const auto& e : desc_layout_) {
+    layoutKey.AddHandle(e);
+  }
+  layoutKey.Add((uint32_t)push_ranges_.size());
+  for (const auto& e : push_ranges_) {
+    layoutKey.Add((uint32_t)e.stageFlags);
+    layoutKey.Add(e.offset);
+    layoutKey.Add(e.size);
+  }
+  pipe_layout_ = objects().pipeline_layouts.Acquire(layoutKey);
+  if (!pipe_layout_) {
+    auto layoutCI = vk::PipelineLayoutCreateInfo()
+                        .setSetLayouts(desc_layout_)
+                        .setPushConstantRanges(push_ranges_);
+    auto created = device().createPipelineLayout(layoutCI);
+    if (!created) {
       return false;
     }
+    pipe_layout_ =
+        objects().pipeline_layouts.InsertOrAcquire(layoutKey, created);
+    if (pipe_layout_ != created) {
+      device().destroy(created);
+    }
+  }
+  return true;
+}
 
-    auto descAI = vk::DescriptorSetAllocateInfo()
-                      .setDescriptorPool(descriptor_pool_)
-                      .setSetLayouts(desc_layout_);
-    descriptor_sets_.resize(dataMap.size());
-    if (device().allocateDescriptorSets(&descAI, descriptor_sets_.data()) !=
-        vk::Result::eSuccess) {
-      return false;
+void PipelineBase::ReleaseLayout() {
+  ReleaseShared(objects().pipeline_layouts, pipe_layout_);
+  for (auto& e : update_templates_) {
+    Release(e);
+  }
+  for (auto& e : desc_layout_) {
+    // The bindless layout belongs to the device.
+    if (bindless() && e == bindless()->layout()) {
+      continue;
     }
+    ReleaseShared(objects().set_layouts, e);
+  }
+  update_templates_.clear();
+  update_sizes_.clear();
+  desc_layout_.clear();
+}
+
+void PipelineBase::SetSpecDefaults(
+    const std::vector<glsl::SpecConstant>& specs) {
+  specs_ = specs;
+  spec_entries_.clear();
+  spec_data_.clear();
+  for (const auto& e : specs_) {
+    auto offset = (uint32_t)spec_data_.size();
+    spec_entries_.emplace_back(e.id, offset, e.size);
+    spec_data_.resize(offset + e.size);
+    memcpy(spec_data_.data() + offset, &e.default_value, e.size);
+  }
+}
+
+bool PipelineBase::WriteSpecConstant(uint32_t id, const void* data,
+                                     uint32_t size) {
+  if (!data) {
+    return false;
+  }
+  for (const auto& e : spec_entries_) {
+    if (e.constantID == id) {
+      if (e.size != size) {
+        return false;
+      }
+      memcpy(spec_data_.data() + e.offset, data, size);
+      return true;
+    }
+  }
+  return false;
+}
+
+Pipeline::Pipeline(Device* parent) : PipelineBase(parent) {}
+
+Pipeline::~Pipeline() {
+  Wait();
+  ReleaseShader();
+}
+
+void Pipeline::ReleaseShader() {
+  ReleaseShared(objects().pipelines, pipeline_);
+  Release(linked_);
+  for (auto& e : libraries_) {
+    ReleaseShared(objects().libraries, e);
+  }
+  ReleaseLayout();
+  for (auto& e : shaders_) {
+    Release(e.shader);
+  }
+  libraries_.clear();
+  shaders_.clear();
+}
+
+bool Pipeline::Reload(const glsl::MetaData& data) {
+  Wait();
+  auto entries = spec_entries_;
+  auto values = spec_data_;
+  ReleaseShader();
+  optimized_ = false;
+  state_ = State::kIdle;
+  job_ = std::future<void>();
+  if (!SetShader(data)) {
+    return false;
+  }
+
+  // Overrides survive as long as the constant keeps its id and size.
+  for (const auto& e : entries) {
+    SetSpecConstant(e.constantID, values.data() + e.offset, (uint32_t)e.size);
+  }
+  return true;
+}
+
+bool Pipeline::SetShader(const glsl::MetaData& data) {
+  if (!CreateLayout(data)) {
+    return false;
+  }
+  SetSpecDefaults(data.specs);
+
+  shader_key_ = CacheKey();
+  for (const auto& e : data.spvs) {
+    auto hash = HashWords(e.data.data(), e.data.size());
+    shader_key_.Add((uint32_t)e.stage);
+    shader_key_.Add((uint32_t)e.data.size());
+    shader_key_.Add((uint32_t)hash);
+    shader_key_.Add((uint32_t)(hash >> 32));
   }
 
   for (const auto& e : data.spvs) {
@@ -96,6 +284,7 @@ bool Pipeline::SetShader(const glsl::MetaData& data) {
       return false;
     }
     shader.stage = e.stage;
+    shader.hash = HashWords(e.data.data(), e.data.size());
     shaders_.push_back(shader);
   }
 
@@ -111,9 +300,33 @@ void Pipeline::SetVertexAttrib(uint32_t location, uint32_t binding,
                                    .setOffset(offset));
 }
 
+bool Pipeline::SetRenderState(const RenderState& state) {
+  if (state_ != State::kIdle) {
+    return false;
+  }
+  render_state_ = state;
+  return true;
+}
+
+bool Pipeline::SetSpecConstant(uint32_t id, const void* data, uint32_t size) {
+  if (state_ != State::kIdle) {
+    return false;
+  }
+  return WriteSpecConstant(id, data, size);
+}
+
 bool Pipeline::Enable(const VertexArray& vertices) {
-  if (pipeline_) {
-    return true;
+  if (!Compile(vertices)) {
+    return false;
+  }
+  Wait();
+  return ready();
+}
+
+bool Pipeline::Compile(const VertexArray& vertices) {
+  auto state = state_.load();
+  if (state != State::kIdle) {
+    return state != State::kFailed;
   }
 
   if (shaders_.empty()) {
@@ -122,12 +335,89 @@ bool Pipeline::Enable(const VertexArray& vertices) {
 
   vertex_bindings_ = vertices.GetBindings();
 
+  auto& key = pipeline_key_;
+  key = shader_key_;
+  key.AddHandle(pipe_layout_);
+  key.AddHandle(render_pass());
+  key.Add((uint32_t)vertex_bindings_.size());
+  for (const auto& e : vertex_bindings_) {
+    key.Add(e.binding);
+    key.Add(e.stride);
+    key.Add((uint32_t)e.inputRate);
+  }
+  key.Add((uint32_t)vertex_attribs_.size());
+  for (const auto& e : vertex_attribs_) {
+    key.Add(e.location);
+    key.Add(e.binding);
+    key.Add((uint32_t)e.format);
+    key.Add(e.offset);
+  }
+  key.Add((uint32_t)spec_data_.size());
+  key.Add(spec_data_.data(), spec_data_.size());
+  const auto& rs = render_state_;
+  key.Add((uint32_t)rs.blend | (uint32_t)rs.depth_only << 1);
+  key.Add((uint32_t)rs.color_write_mask);
+  // Dynamic state pipelines differ only by topology class, the rest is
+  // set while drawing.
+  if (extended_dynamic_state()) {
+    key.Add((uint32_t)GetTopologyClass(rs.topology));
+  } else {
+    key.Add((uint32_t)rs.cull_mode);
+    key.Add((uint32_t)rs.front_face);
+    key.Add((uint32_t)rs.topology);
+    key.Add((uint32_t)rs.depth_test | (uint32_t)rs.depth_write << 1);
+    key.Add((uint32_t)rs.depth_compare);
+  }
+  pipeline_ = objects().pipelines.Acquire(key);
+  if (pipeline_) {
+    optimized_ = true;
+    state_ = State::kReady;
+    return true;
+  }
+
+  state_ = State::kCompiling;
+  auto renderPass = render_pass();
+  auto extent = surface_extent();
+  job_ = workers().Submit(
+      [this, renderPass, extent]() { Build(renderPass, extent); });
+  return true;
+}
+
+void Pipeline::Wait() const {
+  if (job_.valid()) {
+    job_.wait();
+  }
+}
+
+void Pipeline::Build(vk::RenderPass renderPass, vk::Extent2D extent) {
+  const auto& rs = render_state_;
+  // Each stage only sees the constants it declares.
+  std::vector<std::vector<vk::SpecializationMapEntry>> stageEntries(
+      shaders_.size());
+  std::vector<vk::SpecializationInfo> specInfos(shaders_.size());
   std::vector<vk::PipelineShaderStageCreateInfo> shaderStageInfo{};
-  for (const auto& e : shaders_) {
-    shaderStageInfo.emplace_back(vk::PipelineShaderStageCreateInfo()
-                                     .setStage(e.stage)
-                                     .setModule(e.shader)
-                                     .setPName("main"));
+  for (size_t i = 0; i < shaders_.size(); i++) {
+    const auto& e = shaders_[i];
+    if (rs.depth_only && e.stage == vk::ShaderStageFlagBits::eFragment) {
+      continue;
+    }
+    auto stageInfo = vk::PipelineShaderStageCreateInfo()
+                         .setStage(e.stage)
+                         .setModule(e.shader)
+                         .setPName("main");
+    for (size_t j = 0; j < specs_.size(); j++) {
+      if (specs_[j].stages & e.stage) {
+        stageEntries[i].push_back(spec_entries_[j]);
+      }
+    }
+    if (!stageEntries[i].empty()) {
+      specInfos[i]
+          .setMapEntries(stageEntries[i])
+          .setDataSize(spec_data_.size())
+          .setPData(spec_data_.data());
+      stageInfo.setPSpecializationInfo(&specInfos[i]);
+    }
+    shaderStageInfo.push_back(stageInfo);
   }
 
   auto vertexInputInfo = vk::PipelineVertexInputStateCreateInfo()
@@ -135,10 +425,8 @@ bool Pipeline::Enable(const VertexArray& vertices) {
                              .setVertexBindingDescriptions(vertex_bindings_);
 
   auto inputAssemblyInfo =
-      vk::PipelineInputAssemblyStateCreateInfo().setTopology(
-          vk::PrimitiveTopology::eTriangleList);
+      vk::PipelineInputAssemblyStateCreateInfo().setTopology(rs.topology);
 
-  auto& extent = surface_extent();
   std::vector<vk::Viewport> viewports = {vk::Viewport()
                                              .setWidth((float)extent.width)
                                              .setHeight((float)extent.height)
@@ -153,8 +441,8 @@ bool Pipeline::Enable(const VertexArray& vertices) {
                                .setDepthClampEnable(VK_FALSE)
                                .setRasterizerDiscardEnable(VK_FALSE)
                                .setPolygonMode(vk::PolygonMode::eFill)
-                               .setCullMode(vk::CullModeFlagBits::eNone)
-                               .setFrontFace(vk::FrontFace::eCounterClockwise)
+                               .setCullMode(rs.cull_mode)
+                               .setFrontFace(rs.front_face)
                                .setDepthBiasEnable(VK_FALSE)
                                .setLineWidth(1.f);
   auto multisampleInfo = vk::PipelineMultisampleStateCreateInfo();
@@ -165,18 +453,28 @@ bool Pipeline::Enable(const VertexArray& vertices) {
                        .setCompareOp(vk::CompareOp::eAlways);
 
   auto depthStencilInfo = vk::PipelineDepthStencilStateCreateInfo()
-                              .setDepthTestEnable(VK_TRUE)
-                              .setDepthWriteEnable(VK_TRUE)
-                              .setDepthCompareOp(vk::CompareOp::eLessOrEqual)
+                              .setDepthTestEnable(rs.depth_test)
+                              .setDepthWriteEnable(rs.depth_write)
+                              .setDepthCompareOp(rs.depth_compare)
                               .setDepthBoundsTestEnable(VK_FALSE)
                               .setStencilTestEnable(VK_FALSE)
                               .setFront(stencilOp)
                               .setBack(stencilOp);
 
-  vk::PipelineColorBlendAttachmentState const colorBlendAttachments[1] = {
+  auto colorBlendAttachment =
       vk::PipelineColorBlendAttachmentState().setColorWriteMask(
-          vk::ColorComponentFlagBits::eR | vk::ColorComponentFlagBits::eG |
-          vk::ColorComponentFlagBits::eB | vk::ColorComponentFlagBits::eA)};
+          rs.depth_only ? vk::ColorComponentFlags() : rs.color_write_mask);
+  if (rs.blend && !rs.depth_only) {
+    colorBlendAttachment.setBlendEnable(VK_TRUE)
+        .setSrcColorBlendFactor(vk::BlendFactor::eSrcAlpha)
+        .setDstColorBlendFactor(vk::BlendFactor::eOneMinusSrcAlpha)
+        .setColorBlendOp(vk::BlendOp::eAdd)
+        .setSrcAlphaBlendFactor(vk::BlendFactor::eOne)
+        .setDstAlphaBlendFactor(vk::BlendFactor::eOneMinusSrcAlpha)
+        .setAlphaBlendOp(vk::BlendOp::eAdd);
+  }
+  vk::PipelineColorBlendAttachmentState const colorBlendAttachments[1] = {
+      colorBlendAttachment};
 
   auto colorBlendInfo = vk::PipelineColorBlendStateCreateInfo()
                             .setAttachmentCount(1)
@@ -184,6 +482,15 @@ bool Pipeline::Enable(const VertexArray& vertices) {
 
   std::vector<vk::DynamicState> dynamicStates = {vk::DynamicState::eViewport,
                                                  vk::DynamicState::eScissor};
+  if (extended_dynamic_state()) {
+    dynamicStates.insert(dynamicStates.end(),
+                         {vk::DynamicState::eCullModeEXT,
+                          vk::DynamicState::eFrontFaceEXT,
+                          vk::DynamicState::ePrimitiveTopologyEXT,
+                          vk::DynamicState::eDepthTestEnableEXT,
+                          vk::DynamicState::eDepthWriteEnableEXT,
+                          vk::DynamicState::eDepthCompareOpEXT});
+  }
 
   auto dynamicStateInfo =
       vk::PipelineDynamicStateCreateInfo().setDynamicStates(dynamicStates);
@@ -199,19 +506,231 @@ bool Pipeline::Enable(const VertexArray& vertices) {
                         .setPColorBlendState(&colorBlendInfo)
                         .setPDynamicState(&dynamicStateInfo)
                         .setLayout(pipe_layout_)
-                        .setRenderPass(render_pass());
-  auto result = device().createGraphicsPipelines(VK_NULL_HANDLE, 1, &pipelineCI,
-                                                 nullptr, &pipeline_);
-  return result == vk::Result::eSuccess;
+                        .setRenderPass(renderPass);
+
+  // A pipeline linked from cached parts is usable almost at once, the
+  // optimized one below replaces it when it is done.
+  if (pipeline_library()) {
+    linked_ = Link(pipelineCI);
+    if (linked_) {
+      state_ = State::kReady;
+    }
+  }
+
+  vk::PipelineCreationFeedbackEXT feedback{};
+  auto feedbackCI = vk::PipelineCreationFeedbackCreateInfoEXT()
+                        .setPPipelineCreationFeedback(&feedback);
+  if (creation_feedback()) {
+    pipelineCI.setPNext(&feedbackCI);
+  }
+
+  auto& cache = pipeline_cache();
+  vk::Pipeline pipeline{};
+  auto result = device().createGraphicsPipelines(cache.cache(), 1, &pipelineCI,
+                                                 nullptr, &pipeline);
+  if (result != vk::Result::eSuccess) {
+    if (!linked_) {
+      state_ = State::kFailed;
+    }
+    return;
+  }
+  if (creation_feedback()) {
+    cache.Record(feedback);
+  } else {
+    cache.RecordUnknown();
+  }
+
+  // Another pipeline may have finished the same key meanwhile.
+  auto shared = objects().pipelines.InsertOrAcquire(pipeline_key_, pipeline);
+  if (shared != pipeline) {
+    device().destroy(pipeline);
+  }
+  pipeline_ = shared;
+  optimized_ = true;
+  state_ = State::kReady;
+}
+
+vk::Pipeline Pipeline::GetLibrary(vk::GraphicsPipelineLibraryFlagsEXT part,
+                                  const CacheKey& key,
+                                  vk::GraphicsPipelineCreateInfo info) {
+  if (auto library = objects().libraries.Acquire(key)) {
+    return library;
+  }
+
+  auto libraryCI = vk::GraphicsPipelineLibraryCreateInfoEXT().setFlags(part);
+  info.setFlags(vk::PipelineCreateFlagBits::eLibraryKHR).setPNext(&libraryCI);
+  vk::Pipeline library{};
+  if (device().createGraphicsPipelines(pipeline_cache().cache(), 1, &info,
+                                       nullptr, &library) !=
+      vk::Result::eSuccess) {
+    return vk::Pipeline();
+  }
+  auto shared = objects().libraries.InsertOrAcquire(key, library);
+  if (shared != library) {
+    device().destroy(library);
+  }
+  return shared;
+}
+
+vk::Pipeline Pipeline::Link(const vk::GraphicsPipelineCreateInfo& full) {
+  using Part = vk::GraphicsPipelineLibraryFlagBitsEXT;
+  const auto& rs = render_state_;
+  bool dynamic = extended_dynamic_state();
+
+  std::vector<vk::PipelineShaderStageCreateInfo> preRasterStages{};
+  std::vector<vk::PipelineShaderStageCreateInfo> fragmentStages{};
+  for (uint32_t i = 0; i < full.stageCount; i++) {
+    if (full.pStages[i].stage == vk::ShaderStageFlagBits::eFragment) {
+      fragmentStages.push_back(full.pStages[i]);
+    } else {
+      preRasterStages.push_back(full.pStages[i]);
+    }
+  }
+
+  CacheKey vertexKey{};
+  vertexKey.Add((uint32_t)Part::eVertexInputInterface);
+  vertexKey.Add((uint32_t)vertex_bindings_.size());
+  for (const auto& e : vertex_bindings_) {
+    vertexKey.Add(e.binding);
+    vertexKey.Add(e.stride);
+    vertexKey.Add((uint32_t)e.inputRate);
+  }
+  vertexKey.Add((uint32_t)vertex_attribs_.size());
+  for (const auto& e : vertex_attribs_) {
+    vertexKey.Add(e.location);
+    vertexKey.Add(e.binding);
+    vertexKey.Add((uint32_t)e.format);
+    vertexKey.Add(e.offset);
+  }
+  vertexKey.Add(dynamic);
+  vertexKey.Add(dynamic ? GetTopologyClass(rs.topology)
+                        : (uint32_t)rs.topology);
+
+  CacheKey preRasterKey{};
+  preRasterKey.Add((uint32_t)Part::ePreRasterizationShaders);
+  CacheKey fragmentKey{};
+  fragmentKey.Add((uint32_t)Part::eFragmentShader);
+  // Both shader parts depend on the layout, render pass and constants.
+  for (auto* key : {&preRasterKey, &fragmentKey}) {
+    key->AddHandle(pipe_layout_);
+    key->AddHandle(full.renderPass);
+    key->Add((uint32_t)spec_data_.size());
+    key->Add(spec_data_.data(), spec_data_.size());
+  }
+  for (const auto& e : shaders_) {
+    if (e.stage == vk::ShaderStageFlagBits::eFragment && rs.depth_only) {
+      continue;
+    }
+    auto& key = e.stage == vk::ShaderStageFlagBits::eFragment ? fragmentKey
+                                                              : preRasterKey;
+    key.Add((uint32_t)e.stage);
+    key.Add((uint32_t)e.hash);
+    key.Add((uint32_t)(e.hash >> 32));
+  }
+  if (!dynamic) {
+    preRasterKey.Add((uint32_t)rs.cull_mode);
+    preRasterKey.Add((uint32_t)rs.front_face);
+    fragmentKey.Add((uint32_t)rs.depth_test | (uint32_t)rs.depth_write << 1);
+    fragmentKey.Add((uint32_t)rs.depth_compare);
+  }
+  preRasterKey.Add(dynamic);
+  fragmentKey.Add(dynamic);
+
+  CacheKey outputKey{};
+  outputKey.Add((uint32_t)Part::eFragmentOutputInterface);
+  outputKey.AddHandle(full.renderPass);
+  outputKey.Add((uint32_t)rs.blend | (uint32_t)rs.depth_only << 1);
+  outputKey.Add((uint32_t)rs.color_write_mask);
+
+  auto vertexCI = vk::GraphicsPipelineCreateInfo()
+                      .setPVertexInputState(full.pVertexInputState)
+                      .setPInputAssemblyState(full.pInputAssemblyState)
+                      .setPDynamicState(full.pDynamicState);
+  auto preRasterCI = vk::GraphicsPipelineCreateInfo()
+                         .setStages(preRasterStages)
+                         .setPViewportState(full.pViewportState)
+                         .setPRasterizationState(full.pRasterizationState)
+                         .setPDynamicState(full.pDynamicState)
+                         .setLayout(full.layout)
+                         .setRenderPass(full.renderPass);
+  auto fragmentCI = vk::GraphicsPipelineCreateInfo()
+                        .setStages(fragmentStages)
+                        .setPMultisampleState(full.pMultisampleState)
+                        .setPDepthStencilState(full.pDepthStencilState)
+                        .setPDynamicState(full.pDynamicState)
+                        .setLayout(full.layout)
+                        .setRenderPass(full.renderPass);
+  auto outputCI = vk::GraphicsPipelineCreateInfo()
+                      .setPMultisampleState(full.pMultisampleState)
+                      .setPColorBlendState(full.pColorBlendState)
+                      .setPDynamicState(full.pDynamicState)
+                      .setRenderPass(full.renderPass);
+
+  struct LibraryPart {
+    Part part;
+    const CacheKey* key;
+    const vk::GraphicsPipelineCreateInfo* info;
+  };
+  const LibraryPart parts[] = {
+      {Part::eVertexInputInterface, &vertexKey, &vertexCI},
+      {Part::ePreRasterizationShaders, &preRasterKey, &preRasterCI},
+      {Part::eFragmentShader, &fragmentKey, &fragmentCI},
+      {Part::eFragmentOutputInterface, &outputKey, &outputCI},
+  };
+  std::vector<vk::Pipeline> libraries{};
+  for (const auto& e : parts) {
+    auto library = GetLibrary(e.part, *e.key, *e.info);
+    if (!library) {
+      for (auto& lib : libraries) {
+        if (objects().libraries.Release(lib)) {
+          device().destroy(lib);
+        }
+      }
+      return vk::Pipeline();
+    }
+    libraries.push_back(library);
+  }
+  libraries_ = libraries;
+
+  auto linkCI = vk::PipelineLibraryCreateInfoKHR().setLibraries(libraries_);
+  auto pipelineCI = vk::GraphicsPipelineCreateInfo()
+                        .setLayout(full.layout)
+                        .setPNext(&linkCI);
+  vk::Pipeline pipeline{};
+  if (device().createGraphicsPipelines(pipeline_cache().cache(), 1,
+                                       &pipelineCI, nullptr, &pipeline) !=
+      vk::Result::eSuccess) {
+    return vk::Pipeline();
+  }
+  return pipeline;
+}
+
+bool Prewarm(const std::vector<PipelineRequest>& requests) {
+  for (const auto& e : requests) {
+    e.pipeline->Compile(*e.vertices);
+  }
+  bool ready = true;
+  for (const auto& e : requests) {
+    e.pipeline->Wait();
+    ready = ready && e.pipeline->ready();
+  }
+  return ready;
 }
 
 void Pipeline::BindCmd(const vk::CommandBuffer& buf) const {
-  buf.bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline_);
-  if (!descriptor_sets_.empty()) {
-    std::vector<uint32_t> offset{};
-    buf.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipe_layout_, 0,
-                           descriptor_sets_, offset);
+  buf.bindPipeline(vk::PipelineBindPoint::eGraphics,
+                   optimized_ ? pipeline_ : linked_);
+  if (!extended_dynamic_state()) {
+    return;
   }
+  const auto& rs = render_state_;
+  const auto& d = dispatch();
+  buf.setCullModeEXT(rs.cull_mode, d);
+  buf.setFrontFaceEXT(rs.front_face, d);
+  buf.setPrimitiveTopologyEXT(rs.topology, d);
+  buf.setDepthTestEnableEXT(rs.depth_test, d);
+  buf.setDepthWriteEnableEXT(rs.depth_write, d);
+  buf.setDepthCompareOpEXT(rs.depth_compare, d);
 }
 
 } // namespace impl
@@ -2,6 +2,9 @@
 
 #include <vulkan/vulkan.hpp>
 
+#include <atomic>
+#include <future>
+
 #include "Device.h"
 #include "ShaderData.h"
 
@@ -11,7 +14,75 @@ namespace impl {
 
 class VertexArray;
 
-class Pipeline : public DeviceResource {
+// Fixed-function state baked into a pipeline, part of its cache key.
+struct RenderState {
+  vk::CullModeFlags cull_mode = vk::CullModeFlagBits::eNone;
+  vk::FrontFace front_face = vk::FrontFace::eCounterClockwise;
+  vk::PrimitiveTopology topology = vk::PrimitiveTopology::eTriangleList;
+  bool depth_test = true;
+  bool depth_write = true;
+  vk::CompareOp depth_compare = vk::CompareOp::eLessOrEqual;
+  // Straight alpha blending.
+  bool blend = false;
+  vk::ColorComponentFlags color_write_mask =
+      vk::ColorComponentFlagBits::eR | vk::ColorComponentFlagBits::eG |
+      vk::ColorComponentFlagBits::eB | vk::ColorComponentFlagBits::eA;
+  // Drops the fragment stage and every color write, for depth prepasses and
+  // shadow maps. Pair with a position-only vertex layout.
+  bool depth_only = false;
+
+  // Variants for a depth prepass sharing this state's shaders and layout.
+  RenderState DepthOnly() const {
+    auto state = *this;
+    state.depth_only = true;
+    state.depth_test = true;
+    state.depth_write = true;
+    return state;
+  }
+  RenderState DepthEqual() const {
+    auto state = *this;
+    state.depth_test = true;
+    state.depth_write = false;
+    state.depth_compare = vk::CompareOp::eEqual;
+    return state;
+  }
+};
+
+// Set layouts, pipeline layout, update templates and spec constants
+// reflected from shaders, shared by graphics and compute pipelines.
+class PipelineBase : public DeviceResource {
+public:
+  // Makes the given set the device's bindless table, call before SetShader.
+  bool SetBindless(uint32_t set);
+
+  // Number of DescriptorInfo entries expected when updating the set.
+  uint32_t GetDescriptorCount(uint32_t set) const {
+    return set < update_sizes_.size() ? update_sizes_[set] : 0;
+  }
+
+protected:
+  PipelineBase(Device* parent) : DeviceResource(parent) {}
+
+  bool CreateLayout(const glsl::MetaData& data);
+  void ReleaseLayout();
+  void SetSpecDefaults(const std::vector<glsl::SpecConstant>& specs);
+  bool WriteSpecConstant(uint32_t id, const void* data, uint32_t size);
+
+  vk::PipelineLayout pipe_layout_{};
+  std::vector<vk::DescriptorSetLayout> desc_layout_{};
+  std::vector<vk::PushConstantRange> push_ranges_{};
+  // push_ranges_ split where they overlap, each span carrying the stages of
+  // every range covering it, as vkCmdPushConstants requires.
+  std::vector<vk::PushConstantRange> push_spans_{};
+  std::vector<vk::DescriptorUpdateTemplate> update_templates_{};
+  std::vector<uint32_t> update_sizes_{};
+  uint32_t bindless_set_ = UINT32_MAX;
+  std::vector<glsl::SpecConstant> specs_{};
+  std::vector<vk::SpecializationMapEntry> spec_entries_{};
+  std::vector<uint8_t> spec_data_{};
+};
+
+class Pipeline : public PipelineBase {
   friend class DrawParam;
 
 public:
@@ -19,27 +90,75 @@ public:
   ~Pipeline();
 
   bool SetShader(const glsl::MetaData& data);
+  // Replaces the shaders, keeping render state, vertex attributes and spec
+  // constant overrides. The pipeline is idle again afterwards, pass it to
+  // DrawParam::SetPipeline to compile it.
+  bool Reload(const glsl::MetaData& data);
+  // Only allowed before the pipeline starts compiling.
+  bool SetRenderState(const RenderState& state);
+  const RenderState& render_state() const { return render_state_; }
+  // Overrides a reflected constant_id, only before compiling. size must
+  // match the declaration.
+  bool SetSpecConstant(uint32_t id, const void* data, uint32_t size);
+  template <typename T> bool SetSpecConstant(uint32_t id, const T& value) {
+    return SetSpecConstant(id, &value, (uint32_t)sizeof(T));
+  }
+  bool SetSpecConstant(uint32_t id, bool value) {
+    VkBool32 data = value ? VK_TRUE : VK_FALSE;
+    return SetSpecConstant(id, &data, (uint32_t)sizeof(data));
+  }
   void SetVertexAttrib(uint32_t location, uint32_t binding, vk::Format format,
                        uint32_t offset);
+  // Compiles on the calling thread, returns once the pipeline is usable.
   bool Enable(const VertexArray& array);
+  // Starts compiling on the device's workers, false if it cannot be built.
+  bool Compile(const VertexArray& array);
+  void Wait() const;
+  bool ready() const { return state_ == State::kReady; }
+  bool failed() const { return state_ == State::kFailed; }
 
   void BindCmd(const vk::CommandBuffer& buf) const;
 
 private:
+  enum class State { kIdle, kCompiling, kReady, kFailed };
+
+  void ReleaseShader();
+  void Build(vk::RenderPass renderPass, vk::Extent2D extent);
+  vk::Pipeline Link(const vk::GraphicsPipelineCreateInfo& full);
+  vk::Pipeline GetLibrary(vk::GraphicsPipelineLibraryFlagsEXT part,
+                          const CacheKey& key,
+                          vk::GraphicsPipelineCreateInfo info);
+
   struct Module {
     vk::ShaderModule shader{};
     vk::ShaderStageFlagBits stage{};
+    uint64_t hash = 0;
   };
   vk::Pipeline pipeline_{};
-  vk::PipelineLayout pipe_layout_{};
-  std::vector<vk::DescriptorSetLayout> desc_layout_{};
-  vk::DescriptorPool descriptor_pool_{};
-  std::vector<vk::DescriptorSet> descriptor_sets_{};
+  // Linked from libraries, bound until the optimized pipeline_ is done.
+  vk::Pipeline linked_{};
+  std::vector<vk::Pipeline> libraries_{};
+  std::atomic<bool> optimized_{false};
   std::vector<Module> shaders_{};
   std::vector<vk::VertexInputBindingDescription> vertex_bindings_{};
   std::vector<vk::VertexInputAttributeDescription> vertex_attribs_{};
+  RenderState render_state_{};
+  // Stages and SPIR-V hashes, the start of the pipeline's cache key.
+  CacheKey shader_key_{};
+  CacheKey pipeline_key_{};
+  std::atomic<State> state_{State::kIdle};
+  std::future<void> job_{};
 };
 
+struct PipelineRequest {
+  Pipeline* pipeline = nullptr;
+  const VertexArray* vertices = nullptr;
+};
+
+// Compiles all requests in parallel and blocks until every one is done, for
+// loading screens. Returns false if any of them failed.
+bool Prewarm(const std::vector<PipelineRequest>& requests);
+
 } // namespace impl
 
 } // namespace VPP
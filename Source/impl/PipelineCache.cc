@@ -0,0 +1,128 @@
+#include "PipelineCache.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+#ifdef _WIN32
+#include <Windows.h>
+#endif
+
+namespace VPP {
+namespace impl {
+
+// Layout of the header every implementation puts in front of its data.
+struct CacheHeader {
+  uint32_t length;
+  uint32_t version;
+  uint32_t vendor_id;
+  uint32_t device_id;
+  uint8_t uuid[VK_UUID_SIZE];
+};
+
+PipelineCache::PipelineCache(const vk::Device& device,
+                             const vk::PhysicalDeviceProperties& property,
+                             const std::string& fn)
+    : device_(device), property_(property), fn_(fn) {
+  std::vector<char> data{};
+  std::ifstream file(fn_, std::ios::binary);
+  if (file.is_open()) {
+    data.assign(std::istreambuf_iterator<char>(file),
+                std::istreambuf_iterator<char>());
+  }
+  if (!IsCompatible(data)) {
+    data.clear();
+  }
+
+  auto cacheCI = vk::PipelineCacheCreateInfo()
+                     .setInitialDataSize(data.size())
+                     .setPInitialData(data.data());
+  if (device_.createPipelineCache(&cacheCI, nullptr, &cache_) !=
+      vk::Result::eSuccess) {
+    // The driver may still reject data that passed the header check.
+    cacheCI.setInitialDataSize(0).setPInitialData(nullptr);
+    data.clear();
+    if (device_.createPipelineCache(&cacheCI, nullptr, &cache_) !=
+        vk::Result::eSuccess) {
+      cache_ = vk::PipelineCache();
+    }
+  }
+  stats_.loaded_bytes = data.size();
+}
+
+PipelineCache::~PipelineCache() {
+  if (cache_) {
+    device_.destroy(cache_);
+  }
+}
+
+bool PipelineCache::IsCompatible(const std::vector<char>& data) const {
+  CacheHeader header{};
+  if (data.size() < sizeof(header)) {
+    return false;
+  }
+  memcpy(&header, data.data(), sizeof(header));
+  return header.length >= sizeof(header) &&
+         header.version == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+         header.vendor_id == property_.vendorID &&
+         header.device_id == property_.deviceID &&
+         memcmp(header.uuid, property_.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+}
+
+PipelineCacheStats PipelineCache::stats() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return stats_;
+}
+
+void PipelineCache::RecordUnknown() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  stats_.unknown++;
+}
+
+void PipelineCache::Record(const vk::PipelineCreationFeedbackEXT& feedback) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!(feedback.flags & vk::PipelineCreationFeedbackFlagBitsEXT::eValid)) {
+    stats_.unknown++;
+    return;
+  }
+  if (feedback.flags &
+      vk::PipelineCreationFeedbackFlagBitsEXT::eApplicationPipelineCacheHit) {
+    stats_.hits++;
+  } else {
+    stats_.misses++;
+  }
+}
+
+bool PipelineCache::Save() const {
+  if (!cache_ || fn_.empty()) {
+    return false;
+  }
+
+  auto data = device_.getPipelineCacheData(cache_);
+  if (data.empty()) {
+    return false;
+  }
+
+  std::string tmp = fn_ + ".tmp";
+  {
+    std::ofstream file(tmp, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+      return false;
+    }
+    file.write((const char*)data.data(), data.size());
+    if (!file) {
+      return false;
+    }
+  }
+
+#ifdef _WIN32
+  return MoveFileExA(tmp.c_str(), fn_.c_str(),
+                     MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+  return std::rename(tmp.c_str(), fn_.c_str()) == 0;
+#endif
+}
+
+} // namespace impl
+} // namespace VPP
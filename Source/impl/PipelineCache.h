@@ -0,0 +1,50 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include <mutex>
+#include <string>
+
+namespace VPP {
+namespace impl {
+
+struct PipelineCacheStats {
+  // Bytes accepted from disk at startup, 0 when the file was missing or stale.
+  size_t loaded_bytes = 0;
+  uint32_t hits = 0;
+  uint32_t misses = 0;
+  // Pipelines created without creation feedback support.
+  uint32_t unknown = 0;
+};
+
+// A vk::PipelineCache backed by a file, shared by every pipeline of a device.
+class PipelineCache {
+public:
+  PipelineCache(const vk::Device& device,
+                const vk::PhysicalDeviceProperties& property,
+                const std::string& fn);
+  ~PipelineCache();
+
+  const vk::PipelineCache& cache() const { return cache_; }
+  PipelineCacheStats stats() const;
+
+  // Both may be called from pipeline compile workers.
+  void Record(const vk::PipelineCreationFeedbackEXT& feedback);
+  void RecordUnknown();
+
+  // Writes to a temporary file first so a crash never leaves a torn cache.
+  bool Save() const;
+
+private:
+  bool IsCompatible(const std::vector<char>& data) const;
+
+  vk::Device device_{};
+  vk::PhysicalDeviceProperties property_{};
+  std::string fn_{};
+  vk::PipelineCache cache_{};
+  PipelineCacheStats stats_{};
+  mutable std::mutex mutex_{};
+};
+
+} // namespace impl
+} // namespace VPP
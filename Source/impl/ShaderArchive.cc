@@ -0,0 +1,247 @@
+#include "ShaderArchive.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <vector>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "ShaderCache.h"
+#include "ShaderData.h"
+
+namespace VPP {
+namespace glsl {
+
+static const uint32_t kArchiveMagic = 0x41505356; // "VSPA"
+static const uint32_t kArchiveVersion = 3;
+
+// The file is a header, an entry table sorted by name, the names and then
+// the serialized programs. Everything is in words so the mapping can be
+// read as uint32_t directly.
+struct ArchiveHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t count;
+  uint32_t reserved;
+};
+
+struct ArchiveEntry {
+  // Byte offset and length of the name.
+  uint32_t name_offset;
+  uint32_t name_size;
+  // Word offset and length of the program.
+  uint32_t data_offset;
+  uint32_t data_size;
+};
+
+bool WriteArchive(const char* fn,
+                  const std::map<std::string, MetaData>& programs) {
+  std::vector<uint32_t> names{};
+  std::vector<uint32_t> payload{};
+  std::vector<ArchiveEntry> entries{};
+  for (const auto& e : programs) {
+    ArchiveEntry entry{};
+    entry.name_offset = (uint32_t)(names.size() * 4);
+    entry.name_size = (uint32_t)e.first.size();
+    size_t begin = names.size();
+    names.resize(begin + (e.first.size() + 3) / 4);
+    if (!e.first.empty()) {
+      memcpy(&names[begin], e.first.data(), e.first.size());
+    }
+
+    entry.data_offset = (uint32_t)payload.size();
+    Serialize(e.second, payload);
+    entry.data_size = (uint32_t)payload.size() - entry.data_offset;
+    entries.push_back(entry);
+  }
+
+  uint32_t table = (uint32_t)(sizeof(ArchiveHeader) / 4 +
+                              entries.size() * sizeof(ArchiveEntry) / 4);
+  uint32_t data = table + (uint32_t)names.size();
+  for (auto& e : entries) {
+    e.name_offset += table * 4;
+    e.data_offset += data;
+  }
+
+  ArchiveHeader header{kArchiveMagic, kArchiveVersion,
+                       (uint32_t)entries.size(), 0};
+  std::ofstream file(fn, std::ios::binary | std::ios::trunc);
+  if (!file.is_open()) {
+    return false;
+  }
+  file.write((const char*)&header, sizeof(header));
+  file.write((const char*)entries.data(),
+             entries.size() * sizeof(ArchiveEntry));
+  file.write((const char*)names.data(), names.size() * 4);
+  file.write((const char*)payload.data(), payload.size() * 4);
+  return !!file;
+}
+
+struct ArchiveImpl {
+  ~ArchiveImpl() {
+#ifdef _WIN32
+    if (base) {
+      UnmapViewOfFile(base);
+    }
+    if (mapping) {
+      CloseHandle(mapping);
+    }
+    if (file != INVALID_HANDLE_VALUE) {
+      CloseHandle(file);
+    }
+#else
+    if (base) {
+      munmap((void*)base, size);
+    }
+#endif
+  }
+
+  bool Map(const char* fn) {
+#ifdef _WIN32
+    file = CreateFileA(fn, GENERIC_READ, FILE_SHARE_READ, nullptr,
+                       OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+      return false;
+    }
+    LARGE_INTEGER length{};
+    if (!GetFileSizeEx(file, &length) || length.QuadPart == 0) {
+      return false;
+    }
+    mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!mapping) {
+      return false;
+    }
+    base = (const uint8_t*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    size = (size_t)length.QuadPart;
+#else
+    int fd = open(fn, O_RDONLY);
+    if (fd < 0) {
+      return false;
+    }
+    struct stat info {};
+    if (fstat(fd, &info) != 0 || info.st_size == 0) {
+      close(fd);
+      return false;
+    }
+    size = (size_t)info.st_size;
+    void* ptr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    base = ptr == MAP_FAILED ? nullptr : (const uint8_t*)ptr;
+#endif
+    return base != nullptr;
+  }
+
+  bool Validate() {
+    if (size % 4 != 0 || size < sizeof(ArchiveHeader)) {
+      return false;
+    }
+    const auto* header = (const ArchiveHeader*)base;
+    if (header->magic != kArchiveMagic || header->version != kArchiveVersion) {
+      return false;
+    }
+    if (header->count > (size - sizeof(ArchiveHeader)) / sizeof(ArchiveEntry)) {
+      return false;
+    }
+    entries = (const ArchiveEntry*)(base + sizeof(ArchiveHeader));
+    count = header->count;
+    size_t words = size / 4;
+    for (uint32_t i = 0; i < count; i++) {
+      const auto& e = entries[i];
+      if ((size_t)e.name_offset + e.name_size > size ||
+          (size_t)e.data_offset + e.data_size > words) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  const ArchiveEntry* Find(const char* name) const {
+    size_t length = strlen(name);
+    uint32_t first = 0;
+    uint32_t last = count;
+    // Same order as std::string, the writer emits entries from a std::map.
+    while (first < last) {
+      uint32_t middle = (first + last) / 2;
+      const auto& e = entries[middle];
+      int result = memcmp(base + e.name_offset, name,
+                          std::min<size_t>(e.name_size, length));
+      if (result == 0) {
+        if (e.name_size == length) {
+          return &e;
+        }
+        result = e.name_size < length ? -1 : 1;
+      }
+      if (result < 0) {
+        first = middle + 1;
+      } else {
+        last = middle;
+      }
+    }
+    return nullptr;
+  }
+
+  const uint8_t* base = nullptr;
+  size_t size = 0;
+  const ArchiveEntry* entries = nullptr;
+  uint32_t count = 0;
+#ifdef _WIN32
+  HANDLE file = INVALID_HANDLE_VALUE;
+  HANDLE mapping = nullptr;
+#endif
+};
+
+Archive::Archive() : impl_(nullptr) {}
+
+Archive::~Archive() { Close(); }
+
+bool Archive::Open(const char* fn) {
+  Close();
+  auto impl = std::make_unique<ArchiveImpl>();
+  if (!impl->Map(fn) || !impl->Validate()) {
+    return false;
+  }
+  impl_ = impl.release();
+  return true;
+}
+
+void Archive::Close() {
+  if (impl_) {
+    delete impl_;
+    impl_ = nullptr;
+  }
+}
+
+bool Archive::Find(const char* name, const uint32_t*& words,
+                   size_t& count) const {
+  if (!impl_ || !name) {
+    return false;
+  }
+  auto* entry = impl_->Find(name);
+  if (!entry) {
+    return false;
+  }
+  words = (const uint32_t*)impl_->base + entry->data_offset;
+  count = entry->data_size;
+  return true;
+}
+
+bool Archive::GetData(const char* name, MetaData* data) const {
+  const uint32_t* words = nullptr;
+  size_t count = 0;
+  if (!data || !Find(name, words, count)) {
+    return false;
+  }
+  return Deserialize(words, count, *data);
+}
+
+} // namespace glsl
+} // namespace VPP
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <map>
+#include <string>
+
+#include "VPPShader.h"
+
+namespace VPP {
+namespace glsl {
+
+struct ArchiveImpl;
+
+// Writes programs keyed by name into one file, see Archive for the layout.
+SHADER_API bool WriteArchive(const char* fn,
+                             const std::map<std::string, MetaData>& programs);
+
+// Read-only view of a shader archive. The file is memory mapped and entries
+// are looked up in place, glslang is never involved.
+class SHADER_API Archive {
+public:
+  Archive();
+  ~Archive();
+
+  bool Open(const char* fn);
+  void Close();
+
+  // Serialized words of a program, valid while the archive stays open.
+  bool Find(const char* name, const uint32_t*& words, size_t& count) const;
+  bool GetData(const char* name, MetaData* data) const;
+
+  Archive(const Archive&) = delete;
+  Archive& operator=(const Archive&) = delete;
+
+private:
+  ArchiveImpl* impl_ = nullptr;
+};
+
+} // namespace glsl
+} // namespace VPP
@@ -0,0 +1,303 @@
+#include "ShaderCache.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+#include "ShaderData.h"
+
+namespace VPP {
+namespace glsl {
+
+static const uint32_t kCacheMagic = 0x43505356; // "VSPC"
+// Bump whenever the encoding or the compile options change.
+static const uint32_t kCacheVersion = 3;
+static const uint64_t kFnvPrime = 1099511628211ull;
+
+class WordWriter {
+public:
+  explicit WordWriter(std::vector<uint32_t>& words) : words_(words) {}
+
+  void Put(uint32_t value) { words_.push_back(value); }
+  void Put(uint64_t value) {
+    Put((uint32_t)value);
+    Put((uint32_t)(value >> 32));
+  }
+  void Put(const std::string& str) {
+    Put((uint32_t)str.size());
+    size_t begin = words_.size();
+    words_.resize(begin + (str.size() + 3) / 4);
+    if (!str.empty()) {
+      memcpy(&words_[begin], str.data(), str.size());
+    }
+  }
+
+private:
+  std::vector<uint32_t>& words_;
+};
+
+class WordReader {
+public:
+  WordReader(const uint32_t* words, size_t count)
+      : words_(words), count_(count) {}
+
+  bool Get(uint32_t& value) {
+    if (pos_ >= count_) {
+      return false;
+    }
+    value = words_[pos_++];
+    return true;
+  }
+  bool Get(uint64_t& value) {
+    uint32_t low = 0, high = 0;
+    if (!Get(low) || !Get(high)) {
+      return false;
+    }
+    value = (uint64_t)high << 32 | low;
+    return true;
+  }
+  bool Get(std::string& str) {
+    uint32_t size = 0;
+    // In size_t, a corrupt size near UINT32_MAX must not wrap to 0.
+    if (!Get(size) || ((size_t)size + 3) / 4 > count_ - pos_) {
+      return false;
+    }
+    str.assign((const char*)&words_[pos_], size);
+    pos_ += ((size_t)size + 3) / 4;
+    return true;
+  }
+  // An element count, rejected when the remaining words cannot hold that
+  // many elements of at least min_words each.
+  bool GetCount(uint32_t& count, size_t min_words) {
+    return Get(count) && count <= (count_ - pos_) / min_words;
+  }
+  bool Get(std::vector<uint32_t>& data, uint32_t size) {
+    if (size > count_ - pos_) {
+      return false;
+    }
+    data.assign(words_ + pos_, words_ + pos_ + size);
+    pos_ += size;
+    return true;
+  }
+
+private:
+  const uint32_t* words_ = nullptr;
+  size_t count_ = 0;
+  size_t pos_ = 0;
+};
+
+void Serialize(const MetaData& data, std::vector<uint32_t>& words) {
+  WordWriter out(words);
+  out.Put((uint32_t)data.uniforms.size());
+  for (const auto& e : data.uniforms) {
+    out.Put(e.set);
+    out.Put(e.binding);
+    out.Put((uint32_t)e.type);
+    out.Put(e.count);
+    out.Put((uint32_t)e.stages);
+    out.Put(e.name);
+    out.Put(e.block_size);
+    out.Put((uint32_t)e.members.size());
+    for (const auto& member : e.members) {
+      out.Put(member.name);
+      out.Put(member.offset);
+      out.Put(member.size);
+      out.Put(member.type);
+      out.Put(member.count);
+    }
+  }
+  out.Put((uint32_t)data.pushes.size());
+  for (const auto& e : data.pushes) {
+    out.Put((uint32_t)e.stages);
+    out.Put(e.size);
+  }
+  out.Put((uint32_t)data.inputs.size());
+  for (const auto& e : data.inputs) {
+    out.Put(e.location);
+    out.Put((uint32_t)e.format);
+  }
+  out.Put((uint32_t)data.specs.size());
+  for (const auto& e : data.specs) {
+    out.Put(e.id);
+    out.Put(e.size);
+    out.Put(e.default_value);
+    out.Put((uint32_t)e.stages);
+    out.Put(e.name);
+  }
+  out.Put((uint32_t)data.spvs.size());
+  for (const auto& e : data.spvs) {
+    out.Put((uint32_t)e.stage);
+    out.Put((uint32_t)e.data.size());
+    words.insert(words.end(), e.data.begin(), e.data.end());
+  }
+}
+
+bool Deserialize(const uint32_t* words, size_t count, MetaData& data) {
+  WordReader in(words, count);
+  MetaData result{};
+  uint32_t size = 0, value = 0;
+
+  // Counts come from the file, each is checked against the smallest
+  // encoding of its elements before anything is allocated.
+  if (!in.GetCount(size, 8)) {
+    return false;
+  }
+  result.uniforms.resize(size);
+  for (auto& e : result.uniforms) {
+    if (!in.Get(e.set) || !in.Get(e.binding) || !in.Get(value)) {
+      return false;
+    }
+    e.type = (vk::DescriptorType)value;
+    if (!in.Get(e.count) || !in.Get(value)) {
+      return false;
+    }
+    e.stages = (vk::ShaderStageFlags)value;
+    uint32_t members = 0;
+    if (!in.Get(e.name) || !in.Get(e.block_size) ||
+        !in.GetCount(members, 5)) {
+      return false;
+    }
+    e.members.resize(members);
+    for (auto& member : e.members) {
+      if (!in.Get(member.name) || !in.Get(member.offset) ||
+          !in.Get(member.size) || !in.Get(member.type) ||
+          !in.Get(member.count)) {
+        return false;
+      }
+    }
+  }
+
+  if (!in.GetCount(size, 2)) {
+    return false;
+  }
+  result.pushes.resize(size);
+  for (auto& e : result.pushes) {
+    if (!in.Get(value) || !in.Get(e.size)) {
+      return false;
+    }
+    e.stages = (vk::ShaderStageFlags)value;
+  }
+
+  if (!in.GetCount(size, 2)) {
+    return false;
+  }
+  result.inputs.resize(size);
+  for (auto& e : result.inputs) {
+    if (!in.Get(e.location) || !in.Get(value)) {
+      return false;
+    }
+    e.format = (vk::Format)value;
+  }
+
+  if (!in.GetCount(size, 6)) {
+    return false;
+  }
+  result.specs.resize(size);
+  for (auto& e : result.specs) {
+    if (!in.Get(e.id) || !in.Get(e.size) || !in.Get(e.default_value) ||
+        !in.Get(value) || !in.Get(e.name)) {
+      return false;
+    }
+    e.stages = (vk::ShaderStageFlags)value;
+  }
+
+  if (!in.GetCount(size, 2)) {
+    return false;
+  }
+  result.spvs.resize(size);
+  for (auto& e : result.spvs) {
+    uint32_t length = 0;
+    if (!in.Get(value) || !in.Get(length) || !in.Get(e.data, length)) {
+      return false;
+    }
+    e.stage = (vk::ShaderStageFlagBits)value;
+  }
+
+  data.Swap(std::move(result));
+  return true;
+}
+
+void SourceHash::Add(const void* data, size_t size) {
+  const auto* bytes = (const uint8_t*)data;
+  for (size_t i = 0; i < size; i++) {
+    key_ = (key_ ^ bytes[i]) * kFnvPrime;
+    check_ = (check_ ^ bytes[i]) * kFnvPrime;
+  }
+}
+
+ShaderCache::ShaderCache(const std::string& dir) : dir_(dir) {
+#ifdef _WIN32
+  _mkdir(dir_.c_str());
+#else
+  mkdir(dir_.c_str(), 0755);
+#endif
+}
+
+std::string ShaderCache::GetPath(const SourceHash& hash) const {
+  char name[32]{};
+  snprintf(name, sizeof(name), "%016llx.spv",
+           (unsigned long long)hash.key());
+  return dir_ + "/" + name;
+}
+
+bool ShaderCache::Load(const SourceHash& hash, MetaData& data) const {
+  std::ifstream file(GetPath(hash), std::ios::binary);
+  if (!file.is_open()) {
+    return false;
+  }
+  std::vector<char> bytes((std::istreambuf_iterator<char>(file)),
+                          std::istreambuf_iterator<char>());
+  if (bytes.size() % 4 != 0 || bytes.size() < 16) {
+    return false;
+  }
+
+  std::vector<uint32_t> words(bytes.size() / 4);
+  memcpy(words.data(), bytes.data(), bytes.size());
+  uint64_t check = (uint64_t)words[3] << 32 | words[2];
+  if (words[0] != kCacheMagic || words[1] != kCacheVersion ||
+      check != hash.check()) {
+    return false;
+  }
+  return Deserialize(words.data() + 4, words.size() - 4, data);
+}
+
+bool ShaderCache::Store(const SourceHash& hash, const MetaData& data) const {
+  auto path = GetPath(hash);
+  std::lock_guard<std::mutex> lock(mutex_);
+  // Entries are content addressed, an existing one is already right.
+  if (std::ifstream(path).is_open()) {
+    return true;
+  }
+
+  std::vector<uint32_t> words{kCacheMagic, kCacheVersion,
+                              (uint32_t)hash.check(),
+                              (uint32_t)(hash.check() >> 32)};
+  Serialize(data, words);
+
+  auto tmp = path + ".tmp";
+  {
+    std::ofstream file(tmp, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+      return false;
+    }
+    file.write((const char*)words.data(), words.size() * sizeof(uint32_t));
+    if (!file) {
+      return false;
+    }
+  }
+  if (std::rename(tmp.c_str(), path.c_str()) != 0) {
+    std::remove(tmp.c_str());
+    return false;
+  }
+  return true;
+}
+
+} // namespace glsl
+} // namespace VPP
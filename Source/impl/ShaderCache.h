@@ -0,0 +1,55 @@
+#pragma once
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "VPPShader.h"
+
+namespace VPP {
+namespace glsl {
+
+struct MetaData;
+
+// Flat little-endian encoding of MetaData, used by the on-disk cache.
+SHADER_API void Serialize(const MetaData& data, std::vector<uint32_t>& words);
+SHADER_API bool Deserialize(const uint32_t* words, size_t count,
+                            MetaData& data);
+
+// Two independent 64-bit FNV-1a hashes, the second guards the first
+// against collisions when a cache entry is read back.
+class SourceHash {
+public:
+  void Add(const void* data, size_t size);
+  void Add(uint32_t value) { Add(&value, sizeof(value)); }
+  void Add(const std::string& str) {
+    Add((uint32_t)str.size());
+    Add(str.data(), str.size());
+  }
+
+  uint64_t key() const { return key_; }
+  uint64_t check() const { return check_; }
+
+private:
+  uint64_t key_ = 14695981039346656037ull;
+  uint64_t check_ = 0x84222325cbf29ce4ull;
+};
+
+// Compiled programs stored as one file per source hash.
+class ShaderCache {
+public:
+  explicit ShaderCache(const std::string& dir);
+
+  bool Load(const SourceHash& hash, MetaData& data) const;
+  bool Store(const SourceHash& hash, const MetaData& data) const;
+
+private:
+  std::string GetPath(const SourceHash& hash) const;
+
+  std::string dir_{};
+  // Compiler jobs may store the same program at once.
+  mutable std::mutex mutex_{};
+};
+
+} // namespace glsl
+} // namespace VPP
@@ -1,16 +1,35 @@
 #pragma once
 
+#include <string>
 #include <vector>
 #include <vulkan/vulkan.hpp>
 namespace VPP {
 namespace glsl {
 
+// A member of a uniform or storage block at its std140/std430 offset. size
+// runs up to the next member or the end of the block, padding included.
+struct BlockMember {
+  std::string name{};
+  uint32_t offset = 0;
+  uint32_t size = 0;
+  // GLSL element type such as "vec3" or "mat4", empty if unknown.
+  std::string type{};
+  // Array length, 1 for plain members.
+  uint32_t count = 1;
+};
+
 struct Uniform {
   uint32_t set = 0;
   uint32_t binding = 0;
   vk::DescriptorType type = (vk::DescriptorType)~0;
   uint32_t count = 0;
   vk::ShaderStageFlags stages = (vk::ShaderStageFlags)0;
+  // Block or variable name as declared.
+  std::string name{};
+  // Bytes of one block, 0 for samplers and images.
+  uint32_t block_size = 0;
+  // Sorted by offset.
+  std::vector<BlockMember> members{};
 
   operator vk::DescriptorSetLayoutBinding() const {
     return vk::DescriptorSetLayoutBinding()
@@ -53,6 +72,19 @@ struct PushConstant {
   }
 };
 
+// A constant_id declaration, bools are VkBool32 like in VkSpecializationInfo.
+struct SpecConstant {
+  uint32_t id = 0;
+  uint32_t size = 4;
+  uint64_t default_value = 0;
+  vk::ShaderStageFlags stages = (vk::ShaderStageFlags)0;
+  std::string name{};
+
+  friend bool operator<(const SpecConstant& left, const SpecConstant& right) {
+    return left.id < right.id;
+  }
+};
+
 struct SpvData {
   vk::ShaderStageFlagBits stage = (vk::ShaderStageFlagBits)~0;
   std::vector<uint32_t> data{};
@@ -63,12 +95,23 @@ struct MetaData {
   std::vector<glsl::PushConstant> pushes{};
   std::vector<glsl::SpvData> spvs{};
   std::vector<glsl::Input> inputs{};
+  std::vector<glsl::SpecConstant> specs{};
+
+  const Uniform* GetUniform(const std::string& name) const {
+    for (const auto& e : uniforms) {
+      if (e.name == name) {
+        return &e;
+      }
+    }
+    return nullptr;
+  }
 
   void Swap(MetaData&& other) {
     uniforms.swap(other.uniforms);
     pushes.swap(other.pushes);
     spvs.swap(other.spvs);
     inputs.swap(other.inputs);
+    specs.swap(other.specs);
   }
 };
 
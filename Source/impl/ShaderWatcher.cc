@@ -0,0 +1,165 @@
+#include "ShaderWatcher.h"
+
+#include <sys/stat.h>
+
+#include <future>
+#include <iostream>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace VPP {
+namespace impl {
+
+static std::string GetDirectory(const std::string& fn) {
+  auto slash = fn.find_last_of("/\\");
+  return slash == std::string::npos ? std::string() : fn.substr(0, slash);
+}
+
+#ifndef __linux__
+static int64_t GetModifyTime(const std::string& fn) {
+  struct stat info {};
+  if (stat(fn.c_str(), &info) != 0) {
+    return 0;
+  }
+  return (int64_t)info.st_mtime;
+}
+#endif
+
+ShaderWatcher::ShaderWatcher() {
+#ifdef __linux__
+  inotify_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (inotify_ < 0) {
+    std::cerr << "Fail to create inotify instance" << std::endl;
+  }
+#endif
+}
+
+ShaderWatcher::~ShaderWatcher() {
+#ifdef __linux__
+  if (inotify_ >= 0) {
+    close(inotify_);
+  }
+#endif
+}
+
+void ShaderWatcher::Watch(const std::vector<std::string>& files,
+                          Callback&& callback,
+                          const glsl::CompileOptions& options) {
+  Program program{};
+  program.files = files;
+  program.options = options;
+  program.callback = std::move(callback);
+  programs_.push_back(std::move(program));
+  Track(programs_.size() - 1);
+}
+
+void ShaderWatcher::Track(size_t program) {
+  for (auto& e : dependents_) {
+    e.second.erase(program);
+  }
+
+  std::vector<std::string> files = programs_[program].files;
+  for (const auto& e : programs_[program].files) {
+    glsl::GetDependencies(e.c_str(), files);
+  }
+  for (const auto& e : files) {
+    dependents_[e].insert(program);
+    AddFile(e);
+  }
+}
+
+void ShaderWatcher::AddFile(const std::string& fn) {
+#ifdef __linux__
+  if (inotify_ < 0) {
+    return;
+  }
+  // Editors often replace files instead of writing them, so the directory
+  // is watched rather than the file.
+  auto dir = GetDirectory(fn);
+  int wd = inotify_add_watch(inotify_, dir.empty() ? "." : dir.c_str(),
+                             IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+  if (wd >= 0) {
+    dirs_[wd] = dir;
+  }
+#else
+  if (times_.find(fn) == times_.end()) {
+    times_[fn] = GetModifyTime(fn);
+  }
+#endif
+}
+
+void ShaderWatcher::Poll(std::set<std::string>& changed) {
+#ifdef __linux__
+  if (inotify_ < 0) {
+    return;
+  }
+  alignas(inotify_event) char buffer[4096];
+  while (true) {
+    auto length = read(inotify_, buffer, sizeof(buffer));
+    if (length <= 0) {
+      break;
+    }
+    for (ssize_t i = 0; i < length;) {
+      const auto* event = (const inotify_event*)(buffer + i);
+      auto iter = dirs_.find(event->wd);
+      if (iter != dirs_.end() && event->len > 0) {
+        std::string name = event->name;
+        changed.insert(iter->second.empty() ? name
+                                            : iter->second + "/" + name);
+      }
+      i += sizeof(inotify_event) + event->len;
+    }
+  }
+#else
+  for (auto& e : times_) {
+    auto time = GetModifyTime(e.first);
+    if (time != e.second) {
+      e.second = time;
+      changed.insert(e.first);
+    }
+  }
+#endif
+}
+
+uint32_t ShaderWatcher::Update() {
+  std::set<std::string> changed{};
+  Poll(changed);
+
+  std::set<size_t> affected{};
+  for (const auto& e : changed) {
+    auto iter = dependents_.find(e);
+    if (iter != dependents_.end()) {
+      affected.insert(iter->second.begin(), iter->second.end());
+    }
+  }
+  if (affected.empty()) {
+    return 0;
+  }
+
+  std::map<size_t, std::future<glsl::MetaData>> jobs{};
+  for (auto e : affected) {
+    const auto& program = programs_[e];
+    jobs[e] = glsl::Compiler::Get().Compile(program.files, program.options);
+  }
+
+  uint32_t count = 0;
+  for (auto& e : jobs) {
+    auto data = e.second.get();
+    // Includes may have been added or removed by the edit.
+    Track(e.first);
+    if (data.spvs.empty()) {
+      std::cerr << "Fail to rebuild " << programs_[e.first].files[0]
+                << ", keeping the old shaders" << std::endl;
+      continue;
+    }
+    programs_[e.first].callback(data);
+    count++;
+  }
+  return count;
+}
+
+} // namespace impl
+} // namespace VPP
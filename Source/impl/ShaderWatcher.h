@@ -0,0 +1,60 @@
+#pragma once
+
+#include <functional>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "ShaderData.h"
+#include "VPPShader.h"
+
+namespace VPP {
+namespace impl {
+
+// Recompiles programs whose sources or included files changed on disk.
+// Changes come from inotify on Linux and from polling modification times
+// elsewhere.
+class ShaderWatcher {
+public:
+  using Callback = std::function<void(const glsl::MetaData& data)>;
+
+  ShaderWatcher();
+  ~ShaderWatcher();
+
+  // Called with the new data every time the program is rebuilt, typically
+  // Pipeline::Reload followed by DrawParam::SetPipeline.
+  void Watch(const std::vector<std::string>& files, Callback&& callback,
+             const glsl::CompileOptions& options = glsl::CompileOptions());
+
+  // Call between frames on the render thread. Affected programs compile in
+  // parallel, callbacks run here. Returns the number of programs rebuilt.
+  uint32_t Update();
+
+  ShaderWatcher(const ShaderWatcher&) = delete;
+  ShaderWatcher& operator=(const ShaderWatcher&) = delete;
+
+private:
+  struct Program {
+    std::vector<std::string> files{};
+    glsl::CompileOptions options{};
+    Callback callback{};
+  };
+
+  // Rebuilds the file -> program edges of one program.
+  void Track(size_t program);
+  void AddFile(const std::string& fn);
+  void Poll(std::set<std::string>& changed);
+
+  std::vector<Program> programs_{};
+  std::map<std::string, std::set<size_t>> dependents_{};
+#ifdef __linux__
+  int inotify_ = -1;
+  std::map<int, std::string> dirs_{};
+#else
+  std::map<std::string, int64_t> times_{};
+#endif
+};
+
+} // namespace impl
+} // namespace VPP
@@ -0,0 +1,56 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+namespace VPP {
+namespace impl {
+
+ThreadPool::ThreadPool(uint32_t count) {
+  if (count == 0) {
+    count = std::max(std::thread::hardware_concurrency(), 2u) - 1;
+  }
+  for (uint32_t i = 0; i < count; i++) {
+    threads_.emplace_back(&ThreadPool::Run, this);
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  cond_.notify_all();
+  for (auto& e : threads_) {
+    e.join();
+  }
+}
+
+std::future<void> ThreadPool::Submit(std::function<void()>&& job) {
+  std::packaged_task<void()> task(std::move(job));
+  auto future = task.get_future();
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    jobs_.emplace_back(std::move(task));
+  }
+  cond_.notify_one();
+  return future;
+}
+
+void ThreadPool::Run() {
+  while (true) {
+    std::packaged_task<void()> task{};
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cond_.wait(lock, [this]() { return stop_ || !jobs_.empty(); });
+      if (jobs_.empty()) {
+        return;
+      }
+      task = std::move(jobs_.front());
+      jobs_.pop_front();
+    }
+    task();
+  }
+}
+
+} // namespace impl
+} // namespace VPP
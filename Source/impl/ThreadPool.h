@@ -0,0 +1,36 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace VPP {
+namespace impl {
+
+class ThreadPool {
+public:
+  // 0 picks one worker less than the hardware threads, at least one.
+  explicit ThreadPool(uint32_t count = 0);
+  // Queued jobs are still run before the workers exit.
+  ~ThreadPool();
+
+  std::future<void> Submit(std::function<void()>&& job);
+
+  uint32_t size() const { return (uint32_t)threads_.size(); }
+
+private:
+  void Run();
+
+  std::vector<std::thread> threads_{};
+  std::deque<std::packaged_task<void()>> jobs_{};
+  std::mutex mutex_{};
+  std::condition_variable cond_{};
+  bool stop_ = false;
+};
+
+} // namespace impl
+} // namespace VPP
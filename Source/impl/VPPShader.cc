@@ -2,11 +2,21 @@
 
 #include <glslang/Public/ShaderLang.h>
 #include <glslang/SPIRV/GlslangToSpv.h>
+#include <glslang/SPIRV/spirv.hpp>
+#include <spirv-tools/optimizer.hpp>
 
+#include <algorithm>
+#include <cstring>
 #include <fstream>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
 
+#include "ShaderCache.h"
 #include "ShaderData.h"
+#include "ThreadPool.h"
 
 #ifdef _DEBUG
 #pragma comment(lib, "MachineIndependentd.lib")
@@ -151,28 +161,104 @@ static bool LoadFile(const char* fn, std::string& ctx) {
   return true;
 }
 
-static glslang::TShader* CreateShader(const char* filename, EShLanguage stage) {
-  auto shader_ptr = std::make_unique<glslang::TShader>(stage);
-  if (filename == nullptr) {
-    return nullptr;
+// Every shader may use #include "file", resolved next to the includer.
+static const char* kIncludePreamble =
+    "#extension GL_GOOGLE_include_directive : require\n";
+
+static std::string ResolveInclude(const std::string& includer,
+                                  const std::string& header) {
+  auto slash = includer.find_last_of("/\\");
+  if (slash == std::string::npos) {
+    return header;
+  }
+  return includer.substr(0, slash + 1) + header;
+}
+
+using IncludeList = std::vector<std::pair<std::string, std::string>>;
+
+// Appends every file reached through #include with its contents, each one
+// once. Lines inside inactive #if blocks are followed too, a missing file is
+// kept with empty contents and left for the compiler to report.
+static void CollectIncludes(const std::string& fn, const std::string& content,
+                            IncludeList& includes) {
+  std::istringstream stream(content);
+  std::string line{};
+  while (std::getline(stream, line)) {
+    auto begin = line.find_first_not_of(" \t");
+    if (begin == std::string::npos || line.compare(begin, 8, "#include") != 0) {
+      continue;
+    }
+    auto open = line.find_first_of("\"<", begin + 8);
+    auto close = line.find_first_of("\">", open + 1);
+    if (open == std::string::npos || close == std::string::npos) {
+      continue;
+    }
+    auto path = ResolveInclude(fn, line.substr(open + 1, close - open - 1));
+    auto found = std::find_if(
+        includes.begin(), includes.end(),
+        [&path](const IncludeList::value_type& e) { return e.first == path; });
+    if (found != includes.end()) {
+      continue;
+    }
+    std::string header{};
+    if (std::ifstream(path).is_open()) {
+      LoadFile(path.c_str(), header);
+    }
+    includes.emplace_back(path, header);
+    CollectIncludes(path, header, includes);
+  }
+}
+
+class FileIncluder : public glslang::TShader::Includer {
+public:
+  IncludeResult* includeLocal(const char* headerName, const char* includerName,
+                              size_t) override {
+    auto path = ResolveInclude(includerName, headerName);
+    auto* content = new std::string();
+    if (!LoadFile(path.c_str(), *content)) {
+      delete content;
+      return nullptr;
+    }
+    return new IncludeResult(path, content->c_str(), strlen(content->c_str()),
+                             content);
   }
 
+  IncludeResult* includeSystem(const char* headerName,
+                               const char* includerName,
+                               size_t depth) override {
+    return includeLocal(headerName, includerName, depth);
+  }
+
+  void releaseInclude(IncludeResult* result) override {
+    if (result) {
+      delete (std::string*)result->userData;
+      delete result;
+    }
+  }
+};
+
+// The preamble is inserted after #version, variants put their defines there.
+static glslang::TShader* CreateShader(const std::string& content,
+                                      const char* name, EShLanguage stage,
+                                      const std::string& preamble) {
+  auto shader_ptr = std::make_unique<glslang::TShader>(stage);
   TBuiltInResource resource;
   InitResources(resource);
-  std::string content{};
-  if (!LoadFile(filename, content)) {
-    return nullptr;
-  }
 
   const char* const strs[] = {content.c_str()};
-  shader_ptr->setStrings(strs, 1);
+  const char* const names[] = {name};
+  shader_ptr->setStringsWithLengthsAndNames(strs, nullptr, names, 1);
+  auto fullPreamble = kIncludePreamble + preamble;
+  shader_ptr->setPreamble(fullPreamble.c_str());
   shader_ptr->setEntryPoint("main");
   shader_ptr->setEnvInput(kSourceLanguage, static_cast<EShLanguage>(stage),
                           kClient, kGlslVersion);
   shader_ptr->setEnvClient(kClient, kClientVersion);
   shader_ptr->setEnvTarget(kTargetLanguage, kTargetLanguageVersion);
 
-  bool success = shader_ptr->parse(&resource, kGlslVersion, false, kMessages);
+  FileIncluder includer{};
+  bool success = shader_ptr->parse(&resource, kGlslVersion, false, kMessages,
+                                   includer);
   if (success) {
     return shader_ptr.release();
   } else {
@@ -183,6 +269,18 @@ static glslang::TShader* CreateShader(const char* filename, EShLanguage stage) {
   return nullptr;
 }
 
+static glslang::TShader* CreateShader(const char* filename, EShLanguage stage) {
+  if (filename == nullptr) {
+    return nullptr;
+  }
+
+  std::string content{};
+  if (!LoadFile(filename, content)) {
+    return nullptr;
+  }
+  return CreateShader(content, filename, stage, std::string());
+}
+
 static glslang::TProgram*
 CreateProgram(std::vector<glslang::TShader*> shaders) {
   if (shaders.empty()) {
@@ -276,6 +374,8 @@ static vk::ShaderStageFlagBits GetStage(EShLanguage flag) {
     return vk::ShaderStageFlagBits::eGeometry;
   case EShLangFragment:
     return vk::ShaderStageFlagBits::eFragment;
+  case EShLangCompute:
+    return vk::ShaderStageFlagBits::eCompute;
   default:
     break;
   }
@@ -334,6 +434,10 @@ static void AddUniform(std::vector<glsl::Uniform>& uniforms,
     uniform.stages = GetStages(obj.stages);
     uniform.type = descType;
     uniform.count = isSampler ? obj.size : 1;
+    uniform.name = obj.name;
+    if (ttype->getBasicType() == glslang::EbtBlock) {
+      uniform.block_size = (uint32_t)obj.size;
+    }
   }
 
   auto iter = std::find_if(uniforms.begin(), uniforms.end(),
@@ -347,8 +451,299 @@ static void AddUniform(std::vector<glsl::Uniform>& uniforms,
   }
 }
 
+static std::string GetTypeName(const glslang::TType* ttype) {
+  if (!ttype) {
+    return std::string();
+  }
+  std::string prefix{};
+  std::string scalar{};
+  switch (ttype->getBasicType()) {
+  case glslang::EbtFloat:
+    scalar = "float";
+    break;
+  case glslang::EbtDouble:
+    prefix = "d";
+    scalar = "double";
+    break;
+  case glslang::EbtInt:
+    prefix = "i";
+    scalar = "int";
+    break;
+  case glslang::EbtUint:
+    prefix = "u";
+    scalar = "uint";
+    break;
+  case glslang::EbtBool:
+    prefix = "b";
+    scalar = "bool";
+    break;
+  default:
+    return std::string();
+  }
+
+  if (ttype->isMatrix()) {
+    auto cols = ttype->getMatrixCols();
+    auto rows = ttype->getMatrixRows();
+    auto name = prefix + "mat" + std::to_string(cols);
+    if (cols != rows) {
+      name += "x" + std::to_string(rows);
+    }
+    return name;
+  } else if (ttype->isVector()) {
+    return prefix + "vec" + std::to_string(ttype->getVectorSize());
+  }
+  return scalar;
+}
+
+static void AddMember(std::vector<glsl::Uniform>& uniforms,
+                      const glslang::TObjectReflection& obj,
+                      const glslang::TObjectReflection& block) {
+  const auto* ttype = block.getType();
+  if (!ttype || ttype->getQualifier().isPushConstant() || obj.offset < 0) {
+    return;
+  }
+  const auto& q = ttype->getQualifier();
+  uint32_t set = q.hasSet() ? q.layoutSet : 0;
+  uint32_t binding = q.hasBinding() ? q.layoutBinding : 0;
+  auto iter = std::find_if(uniforms.begin(), uniforms.end(),
+                           [set, binding](const glsl::Uniform& e) {
+                             return e.set == set && e.binding == binding;
+                           });
+  if (iter == uniforms.end()) {
+    return;
+  }
+
+  // Reflection names members "Block.member".
+  glsl::BlockMember member{};
+  auto dot = obj.name.find('.');
+  member.name = dot == std::string::npos ? obj.name : obj.name.substr(dot + 1);
+  member.offset = (uint32_t)obj.offset;
+  member.type = GetTypeName(obj.getType());
+  member.count = obj.getType() && obj.getType()->isArray() ? obj.size : 1;
+  iter->members.push_back(member);
+}
+
+static void AddMembers(std::vector<glsl::Uniform>& uniforms,
+                       const glslang::TProgram& program) {
+  for (int i = 0; i < program.getNumUniformVariables(); i++) {
+    const auto& obj = program.getUniform(i);
+    if (obj.index >= 0) {
+      AddMember(uniforms, obj, program.getUniformBlock(obj.index));
+    }
+  }
+  for (int i = 0; i < program.getNumBufferVariables(); i++) {
+    const auto& obj = program.getBufferVariable(i);
+    if (obj.index >= 0) {
+      AddMember(uniforms, obj, program.getBufferBlock(obj.index));
+    }
+  }
+
+  for (auto& e : uniforms) {
+    auto& members = e.members;
+    std::sort(members.begin(), members.end(),
+              [](const glsl::BlockMember& left,
+                 const glsl::BlockMember& right) {
+                return left.offset < right.offset;
+              });
+    for (size_t i = 0; i < members.size(); i++) {
+      uint32_t end = i + 1 < members.size() ? members[i + 1].offset
+                                            : e.block_size;
+      members[i].size = end > members[i].offset ? end - members[i].offset : 0;
+    }
+  }
+}
+
+// glslang's reflection skips constant_id, so they are read from the SPIR-V.
+static void AddSpecConstants(std::vector<glsl::SpecConstant>& specs,
+                             const glsl::SpvData& spv) {
+  const auto& words = spv.data;
+  std::map<uint32_t, uint32_t> specIds{};
+  std::map<uint32_t, std::string> names{};
+  std::map<uint32_t, uint32_t> typeSizes{};
+
+  for (size_t i = 5; i < words.size();) {
+    uint32_t count = words[i] >> 16;
+    auto op = (spv::Op)(words[i] & 0xffff);
+    if (count == 0 || i + count > words.size()) {
+      break;
+    }
+    const uint32_t* args = &words[i + 1];
+
+    switch (op) {
+    case spv::OpName:
+      names[args[0]] = (const char*)&args[1];
+      break;
+    case spv::OpDecorate:
+      if (count >= 4 && args[1] == spv::DecorationSpecId) {
+        specIds[args[0]] = args[2];
+      }
+      break;
+    case spv::OpTypeBool:
+      typeSizes[args[0]] = sizeof(VkBool32);
+      break;
+    case spv::OpTypeInt:
+    case spv::OpTypeFloat:
+      typeSizes[args[0]] = args[1] / 8;
+      break;
+    case spv::OpSpecConstantTrue:
+    case spv::OpSpecConstantFalse:
+    case spv::OpSpecConstant: {
+      auto id = specIds.find(args[1]);
+      if (id == specIds.end()) {
+        break;
+      }
+      glsl::SpecConstant spec{};
+      spec.id = id->second;
+      spec.size = typeSizes.count(args[0]) ? typeSizes[args[0]] : 4;
+      spec.stages = spv.stage;
+      if (op == spv::OpSpecConstantTrue) {
+        spec.default_value = 1;
+      } else if (op == spv::OpSpecConstant) {
+        spec.default_value = args[2];
+        if (spec.size == 8 && count > 4) {
+          spec.default_value |= (uint64_t)args[3] << 32;
+        }
+      }
+      if (names.count(args[1])) {
+        spec.name = names[args[1]];
+      }
+
+      auto iter = std::find_if(
+          specs.begin(), specs.end(),
+          [&spec](const glsl::SpecConstant& e) { return e.id == spec.id; });
+      if (iter == specs.end()) {
+        specs.push_back(spec);
+      } else {
+        iter->stages |= spec.stages;
+      }
+      break;
+    }
+    default:
+      break;
+    }
+    i += count;
+  }
+}
+
+static uint32_t CountInstructions(const std::vector<uint32_t>& spv) {
+  uint32_t count = 0;
+  // The first five words are the module header.
+  for (size_t i = 5; i < spv.size(); count++) {
+    uint32_t length = spv[i] >> 16;
+    if (length == 0) {
+      break;
+    }
+    i += length;
+  }
+  return count;
+}
+
+static void OptimizeSpv(glsl::SpvData& spv, const CompileOptions& options) {
+  if (options.optimize == OptimizeLevel::kNone && !options.strip_debug) {
+    return;
+  }
+
+  spvtools::Optimizer optimizer(SPV_ENV_VULKAN_1_1);
+  optimizer.SetMessageConsumer([](spv_message_level_t level, const char*,
+                                  const spv_position_t&, const char* message) {
+    if (level <= SPV_MSG_ERROR) {
+      std::cerr << message << std::endl;
+    }
+  });
+  if (options.optimize == OptimizeLevel::kPerformance) {
+    optimizer.RegisterPerformancePasses();
+  } else if (options.optimize == OptimizeLevel::kSize) {
+    optimizer.RegisterSizePasses();
+  }
+  if (options.strip_debug) {
+    optimizer.RegisterPass(spvtools::CreateStripDebugInfoPass());
+    optimizer.RegisterPass(spvtools::CreateStripNonSemanticInfoPass());
+  }
+
+  std::vector<uint32_t> result{};
+  // A failed run keeps the module glslang produced.
+  if (!optimizer.Run(spv.data.data(), spv.data.size(), &result)) {
+    return;
+  }
+  if (options.report) {
+    std::cout << vk::to_string(spv.stage) << ": "
+              << CountInstructions(spv.data) << " -> "
+              << CountInstructions(result) << " instructions" << std::endl;
+  }
+  spv.data.swap(result);
+}
+
+// glslang keeps process-wide tables, they are set up once for every user.
+static void InitProcess() {
+  static struct Process {
+    Process() { glslang::InitializeProcess(); }
+    ~Process() { glslang::FinalizeProcess(); }
+  } process;
+}
+
+static ShaderCache& GetCache() {
+  static ShaderCache cache("shader_cache");
+  return cache;
+}
+
+struct SourceFile {
+  std::string name{};
+  EShLanguage stage;
+  std::string content{};
+  IncludeList includes{};
+};
+
+static bool LoadSources(const std::vector<const char*>& files,
+                        std::vector<SourceFile>& sources) {
+  for (auto fn : files) {
+    SourceFile source{};
+    source.name = fn;
+    if (!FindStage(fn, source.stage) || !LoadFile(fn, source.content)) {
+      return false;
+    }
+    CollectIncludes(fn, source.content, source.includes);
+    sources.push_back(std::move(source));
+  }
+  return true;
+}
+
+// Covers everything that changes the output of a compile.
+static void HashSources(const std::vector<SourceFile>& sources,
+                        const CompileOptions& options, SourceHash& hash) {
+  hash.Add((uint32_t)options.optimize);
+  hash.Add((uint32_t)options.strip_debug);
+  hash.Add((uint32_t)kGlslVersion);
+  hash.Add((uint32_t)kClientVersion);
+  hash.Add((uint32_t)kTargetLanguageVersion);
+  hash.Add((uint32_t)kMessages);
+  hash.Add(std::string(kIncludePreamble));
+  for (const auto& e : sources) {
+    hash.Add((uint32_t)e.stage);
+    hash.Add(e.content);
+    hash.Add((uint32_t)e.includes.size());
+    for (const auto& include : e.includes) {
+      hash.Add(include.first);
+      hash.Add(include.second);
+    }
+  }
+}
+
+static bool HashSources(const std::vector<const char*>& files,
+                        const CompileOptions& options, SourceHash& hash) {
+  std::vector<SourceFile> sources{};
+  if (!LoadSources(files, sources)) {
+    return false;
+  }
+  HashSources(sources, options, hash);
+  return true;
+}
+
 struct ReaderImpl {
-  ReaderImpl() { glslang::InitializeProcess(); }
+  ReaderImpl() { InitProcess(); }
+  // Served from the cache, glslang is never initialized.
+  explicit ReaderImpl(glsl::MetaData&& cached) : cached_(true) {
+    data_.Swap(std::move(cached));
+  }
 
   ~ReaderImpl() {
     if (program_) {
@@ -361,8 +756,6 @@ struct ReaderImpl {
       }
     }
     shaders_.clear();
-
-    glslang::FinalizeProcess();
   }
 
   bool AddShader(const char* fn) {
@@ -387,6 +780,9 @@ struct ReaderImpl {
     return false;
   }
 
+  // Takes a shader parsed elsewhere.
+  void AddShader(glslang::TShader* shader) { shaders_.push_back(shader); }
+
   bool Link() {
     if (auto program = CreateProgram(shaders_)) {
       program_ = program;
@@ -396,7 +792,13 @@ struct ReaderImpl {
     return false;
   }
 
-  void Query(glsl::MetaData& data_) const {
+  bool cached() const { return cached_; }
+
+  void Query(glsl::MetaData& result) const {
+    if (cached_) {
+      result = data_;
+      return;
+    }
     glsl::MetaData data{};
 
     for (int32_t i = 0; i < program_->getNumUniformVariables(); i++) {
@@ -428,16 +830,10 @@ struct ReaderImpl {
 
       AddUniform(data.uniforms, obj, ttype);
     }
+    AddMembers(data.uniforms, *program_);
 
+    // Unused sets below the highest one are left to the pipeline layout.
     std::sort(data.uniforms.begin(), data.uniforms.end());
-    if (!data.uniforms.empty() && data.uniforms[0].set != 0) {
-      return;
-    }
-    for (size_t i = 0; i + 1 < data.uniforms.size(); ++i) {
-      if (data.uniforms[i + 1].set - data.uniforms[i].set > 1) {
-        return;
-      }
-    }
 
     for (const auto& shader : shaders_) {
       auto stage = shader->getStage();
@@ -447,8 +843,12 @@ struct ReaderImpl {
         spv.stage = GetStage(stage);
         spv.data.clear();
         glslang::GlslangToSpv(*temp, spv.data);
+        // Spec constant names come from OpName, read them before stripping.
+        AddSpecConstants(data.specs, spv);
+        OptimizeSpv(spv, options);
       }
     }
+    std::sort(data.specs.begin(), data.specs.end());
 
     for (int i = 0; i < program_->getNumPipeInputs(); ++i) {
       auto& obj = program_->getPipeInput(i);
@@ -465,26 +865,37 @@ struct ReaderImpl {
       }
       data.inputs.push_back(input);
     }
+    // Locations may skip, matrices take one per column.
     std::sort(data.inputs.begin(), data.inputs.end());
-    if (!data.inputs.empty() && data.inputs[0].location != 0) {
-      return;
-    }
-    for (size_t i = 0; i + 1 < data.inputs.size(); ++i) {
-      if (data.inputs[i + 1].location - data.inputs[i].location > 1) {
-        return;
-      }
-    }
 
-    data_.Swap(std::move(data));
+    result.Swap(std::move(data));
   }
 
+  SourceHash hash{};
+  bool cacheable = false;
+  CompileOptions options{};
+
 private:
   std::vector<glslang::TShader*> shaders_{};
   glslang::TProgram* program_{};
+  bool cached_ = false;
+  glsl::MetaData data_{};
 };
 
-Reader::Reader(std::vector<const char*> files) {
+Reader::Reader(std::vector<const char*> files,
+               const CompileOptions& options) {
+  SourceHash hash{};
+  bool cacheable = HashSources(files, options, hash);
+  glsl::MetaData cached{};
+  if (cacheable && GetCache().Load(hash, cached)) {
+    impl_ = new ReaderImpl(std::move(cached));
+    return;
+  }
+
   auto impl = std::make_unique<ReaderImpl>();
+  impl->hash = hash;
+  impl->cacheable = cacheable;
+  impl->options = options;
   do {
     for (auto fn : files) {
       if (!impl->AddShader(fn)) {
@@ -514,6 +925,251 @@ bool Reader::GetData(MetaData* data) {
   }
 
   impl_->Query(*data);
+  if (!impl_->cached() && impl_->cacheable && !data->spvs.empty()) {
+    GetCache().Store(impl_->hash, *data);
+  }
+  return true;
+}
+
+struct CompilerImpl {
+  impl::ThreadPool pool{};
+};
+
+struct CompileJob {
+  // One slot per source file, filled by the parse jobs.
+  std::vector<glslang::TShader*> shaders{};
+  std::vector<std::future<void>> parsed{};
+  std::promise<MetaData> result{};
+};
+
+Compiler& Compiler::Get() {
+  static Compiler compiler{};
+  return compiler;
+}
+
+Compiler::Compiler() {
+  InitProcess();
+  impl_ = new CompilerImpl();
+}
+
+Compiler::~Compiler() {
+  if (impl_) {
+    delete impl_;
+  }
+}
+
+std::future<MetaData> Compiler::Compile(const std::vector<std::string>& files,
+                                        const CompileOptions& options) {
+  auto job = std::make_shared<CompileJob>();
+  auto future = job->result.get_future();
+
+  // Hashing only reads the sources, a warm cache never reaches the pool.
+  std::vector<const char*> names{};
+  for (const auto& e : files) {
+    names.push_back(e.c_str());
+  }
+  SourceHash hash{};
+  bool cacheable = HashSources(names, options, hash);
+  MetaData cached{};
+  if (cacheable && GetCache().Load(hash, cached)) {
+    job->result.set_value(std::move(cached));
+    return future;
+  }
+
+  std::vector<EShLanguage> stages{};
+  for (const auto& fn : files) {
+    EShLanguage stage;
+    if (!FindStage(fn.c_str(), stage) ||
+        std::find(stages.begin(), stages.end(), stage) != stages.end()) {
+      job->result.set_value(MetaData());
+      return future;
+    }
+    stages.push_back(stage);
+  }
+
+  auto& pool = impl_->pool;
+  job->shaders.resize(files.size(), nullptr);
+  for (size_t i = 0; i < files.size(); i++) {
+    auto fn = files[i];
+    auto stage = stages[i];
+    job->parsed.push_back(pool.Submit([job, i, fn, stage]() {
+      job->shaders[i] = CreateShader(fn.c_str(), stage);
+    }));
+  }
+
+  // The pool is FIFO, so by the time a worker picks up the link job every
+  // parse job has been started and waiting on them cannot starve the pool.
+  pool.Submit([job, hash, cacheable, options]() {
+    ReaderImpl reader{};
+    reader.options = options;
+    bool parsed = true;
+    for (size_t i = 0; i < job->shaders.size(); i++) {
+      job->parsed[i].wait();
+      if (job->shaders[i]) {
+        reader.AddShader(job->shaders[i]);
+      } else {
+        parsed = false;
+      }
+    }
+
+    MetaData data{};
+    if (parsed && reader.Link()) {
+      reader.Query(data);
+      if (cacheable && !data.spvs.empty()) {
+        GetCache().Store(hash, data);
+      }
+    }
+    job->result.set_value(std::move(data));
+  });
+  return future;
+}
+
+struct PermutationImpl {
+  // Loaded and hashed once, variants only differ in their preamble.
+  std::vector<SourceFile> sources{};
+  std::vector<std::string> keywords{};
+  CompileOptions options{};
+  SourceHash hash{};
+  std::mutex mutex{};
+  std::map<uint64_t, MetaData> variants{};
+};
+
+static void AddKeywords(const std::string& content,
+                        std::vector<std::string>& keywords) {
+  std::istringstream stream(content);
+  std::string line{};
+  while (std::getline(stream, line)) {
+    std::istringstream tokens(line);
+    std::string token{};
+    if (!(tokens >> token) || token != "#pragma" || !(tokens >> token) ||
+        token != "keywords") {
+      continue;
+    }
+    while (tokens >> token) {
+      if (std::find(keywords.begin(), keywords.end(), token) ==
+          keywords.end()) {
+        keywords.push_back(token);
+      }
+    }
+  }
+}
+
+bool GetDependencies(const char* fn, std::vector<std::string>& deps) {
+  std::string content{};
+  if (!fn || !LoadFile(fn, content)) {
+    return false;
+  }
+  IncludeList includes{};
+  CollectIncludes(fn, content, includes);
+  for (auto& e : includes) {
+    deps.push_back(std::move(e.first));
+  }
+  return true;
+}
+
+Permutation::Permutation() : impl_(nullptr) {}
+
+Permutation::Permutation(std::vector<const char*> files,
+                         const CompileOptions& options) {
+  auto impl = std::make_unique<PermutationImpl>();
+  if (!LoadSources(files, impl->sources)) {
+    return;
+  }
+  for (const auto& e : impl->sources) {
+    AddKeywords(e.content, impl->keywords);
+  }
+  if (impl->keywords.size() > 64) {
+    std::cerr << "Too many keywords, at most 64 are supported" << std::endl;
+    return;
+  }
+
+  impl->options = options;
+  HashSources(impl->sources, options, impl->hash);
+  impl_ = impl.release();
+}
+
+Permutation::~Permutation() {
+  if (impl_) {
+    delete impl_;
+  }
+}
+
+uint32_t Permutation::GetKeywordCount() const {
+  return impl_ ? (uint32_t)impl_->keywords.size() : 0;
+}
+
+const char* Permutation::GetKeyword(uint32_t index) const {
+  if (!impl_ || index >= impl_->keywords.size()) {
+    return nullptr;
+  }
+  return impl_->keywords[index].c_str();
+}
+
+uint64_t Permutation::GetMask(const char* keyword) const {
+  if (!impl_ || !keyword) {
+    return 0;
+  }
+  for (size_t i = 0; i < impl_->keywords.size(); i++) {
+    if (impl_->keywords[i] == keyword) {
+      return 1ull << i;
+    }
+  }
+  return 0;
+}
+
+bool Permutation::GetData(uint64_t mask, MetaData* data) {
+  if (!impl_ || !data) {
+    return false;
+  }
+
+  auto count = impl_->keywords.size();
+  if (count < 64) {
+    mask &= (1ull << count) - 1;
+  }
+  {
+    std::lock_guard<std::mutex> lock(impl_->mutex);
+    auto iter = impl_->variants.find(mask);
+    if (iter != impl_->variants.end()) {
+      *data = iter->second;
+      return true;
+    }
+  }
+
+  std::string preamble{};
+  for (size_t i = 0; i < count; i++) {
+    if (mask >> i & 1) {
+      preamble += "#define " + impl_->keywords[i] + " 1\n";
+    }
+  }
+  auto hash = impl_->hash;
+  hash.Add(preamble);
+
+  // Compiled outside the lock so different variants build concurrently.
+  MetaData variant{};
+  if (!GetCache().Load(hash, variant)) {
+    ReaderImpl reader{};
+    reader.options = impl_->options;
+    bool parsed = true;
+    for (const auto& e : impl_->sources) {
+      if (auto shader =
+              CreateShader(e.content, e.name.c_str(), e.stage, preamble)) {
+        reader.AddShader(shader);
+      } else {
+        parsed = false;
+      }
+    }
+    if (!parsed || !reader.Link()) {
+      return false;
+    }
+    reader.Query(variant);
+    if (variant.spvs.empty()) {
+      return false;
+    }
+    GetCache().Store(hash, variant);
+  }
+
+  std::lock_guard<std::mutex> lock(impl_->mutex);
+  *data = impl_->variants.emplace(mask, std::move(variant)).first->second;
   return true;
 }
 
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <future>
+#include <string>
 #include <vector>
 
 #ifdef VPPSHADER_EXPORTS
@@ -13,11 +15,29 @@ namespace glsl {
 
 struct MetaData;
 struct ReaderImpl;
+struct CompilerImpl;
+struct PermutationImpl;
+
+enum class OptimizeLevel {
+  kNone,
+  kPerformance,
+  kSize,
+};
+
+// Run on the SPIR-V of every stage after reflection.
+struct CompileOptions {
+  OptimizeLevel optimize = OptimizeLevel::kNone;
+  // Drops names, line info and non-semantic instructions.
+  bool strip_debug = false;
+  // Prints instruction counts before and after optimizing.
+  bool report = false;
+};
 
 class SHADER_API Reader {
 public:
   Reader();
-  Reader(std::vector<const char*> files);
+  Reader(std::vector<const char*> files,
+         const CompileOptions& options = CompileOptions());
   ~Reader();
 
   bool GetData(MetaData* data);
@@ -26,5 +46,56 @@ private:
   ReaderImpl* impl_ = nullptr;
 };
 
+// A program whose sources declare feature keywords with
+// "#pragma keywords FOG SHADOWS". A variant is a mask over the keywords, each
+// set bit is passed as "#define KEYWORD 1". Variants are compiled the first
+// time they are requested and kept in memory and in the shader cache.
+class SHADER_API Permutation {
+public:
+  Permutation();
+  Permutation(std::vector<const char*> files,
+              const CompileOptions& options = CompileOptions());
+  ~Permutation();
+
+  uint32_t GetKeywordCount() const;
+  const char* GetKeyword(uint32_t index) const;
+  // 0 for a keyword the sources do not declare.
+  uint64_t GetMask(const char* keyword) const;
+
+  // Thread safe, unknown bits of the mask are ignored.
+  bool GetData(uint64_t mask, MetaData* data);
+
+  Permutation(const Permutation&) = delete;
+  Permutation& operator=(const Permutation&) = delete;
+
+private:
+  PermutationImpl* impl_ = nullptr;
+};
+
+// Files reached from fn through #include, found by scanning the text.
+SHADER_API bool GetDependencies(const char* fn,
+                                std::vector<std::string>& deps);
+
+// Process-wide compiler, safe to call from any thread. Programs are
+// compiled on a worker pool with their stages parsed in parallel.
+class SHADER_API Compiler {
+public:
+  static Compiler& Get();
+
+  // The result has no spvs when compiling or linking failed.
+  std::future<MetaData>
+  Compile(const std::vector<std::string>& files,
+          const CompileOptions& options = CompileOptions());
+
+  Compiler(const Compiler&) = delete;
+  Compiler& operator=(const Compiler&) = delete;
+
+private:
+  Compiler();
+  ~Compiler();
+
+  CompilerImpl* impl_ = nullptr;
+};
+
 } // namespace glsl
 } // namespace VPP
\ No newline at end of file
@@ -0,0 +1,175 @@
+#include <vulkan/vulkan.hpp>
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#include "impl/Descriptor.h"
+
+using namespace VPP;
+
+// Rewrites one set of uniform buffer bindings, once through a descriptor
+// update template as Pipeline builds them and once with a
+// vkUpdateDescriptorSets call per binding as the slot bindings do.
+
+static const vk::DeviceSize kRange = 256;
+
+static void Usage() {
+  std::cerr << "Usage: DescriptorBench [iterations] [bindings]" << std::endl;
+}
+
+static bool FindMemoryType(const vk::PhysicalDevice& gpu, uint32_t bits,
+                           uint32_t& typeIndex) {
+  auto props = gpu.getMemoryProperties();
+  for (uint32_t i = 0; i < props.memoryTypeCount; i++) {
+    if (bits & (1u << i)) {
+      typeIndex = i;
+      return true;
+    }
+  }
+  return false;
+}
+
+template <typename F> static double TimeNs(uint32_t iterations, F&& body) {
+  auto begin = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < iterations; i++) {
+    body();
+  }
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::nano>(end - begin).count() /
+         iterations;
+}
+
+int main(int argc, char** argv) {
+  uint32_t iterations = 100000;
+  uint32_t count = 8;
+  if (argc > 3) {
+    Usage();
+    return 1;
+  }
+  if (argc > 1) {
+    iterations = (uint32_t)strtoul(argv[1], nullptr, 10);
+  }
+  if (argc > 2) {
+    count = (uint32_t)strtoul(argv[2], nullptr, 10);
+  }
+  if (!iterations || !count) {
+    Usage();
+    return 1;
+  }
+
+  auto appInfo = vk::ApplicationInfo()
+                     .setPApplicationName("DescriptorBench")
+                     .setApiVersion(VK_API_VERSION_1_1);
+  auto instanceCI = vk::InstanceCreateInfo().setPApplicationInfo(&appInfo);
+  auto instance = vk::createInstance(instanceCI);
+  auto gpus = instance.enumeratePhysicalDevices();
+  if (gpus.empty()) {
+    std::cerr << "No Vulkan device found" << std::endl;
+    instance.destroy();
+    return 1;
+  }
+  auto gpu = gpus[0];
+  std::cout << "Device: " << gpu.getProperties().deviceName << std::endl;
+
+  float priority = 1.f;
+  auto queueCI = vk::DeviceQueueCreateInfo()
+                     .setQueueFamilyIndex(0)
+                     .setQueueCount(1)
+                     .setPQueuePriorities(&priority);
+  auto device =
+      gpu.createDevice(vk::DeviceCreateInfo().setQueueCreateInfos(queueCI));
+
+  auto buffer = device.createBuffer(
+      vk::BufferCreateInfo()
+          .setSize(kRange * count)
+          .setUsage(vk::BufferUsageFlagBits::eUniformBuffer));
+  auto req = device.getBufferMemoryRequirements(buffer);
+  uint32_t typeIndex = 0;
+  if (!FindMemoryType(gpu, req.memoryTypeBits, typeIndex)) {
+    std::cerr << "No memory type for the uniform buffer" << std::endl;
+    return 1;
+  }
+  auto memory = device.allocateMemory(vk::MemoryAllocateInfo()
+                                          .setAllocationSize(req.size)
+                                          .setMemoryTypeIndex(typeIndex));
+  device.bindBufferMemory(buffer, memory, 0);
+
+  std::vector<vk::DescriptorSetLayoutBinding> bindings{};
+  std::vector<vk::DescriptorUpdateTemplateEntry> entries{};
+  std::vector<impl::DescriptorInfo> infos(count);
+  for (uint32_t i = 0; i < count; i++) {
+    bindings.emplace_back(vk::DescriptorSetLayoutBinding()
+                              .setBinding(i)
+                              .setDescriptorType(
+                                  vk::DescriptorType::eUniformBuffer)
+                              .setDescriptorCount(1)
+                              .setStageFlags(vk::ShaderStageFlagBits::eAll));
+    entries.emplace_back(vk::DescriptorUpdateTemplateEntry()
+                             .setDstBinding(i)
+                             .setDstArrayElement(0)
+                             .setDescriptorCount(1)
+                             .setDescriptorType(
+                                 vk::DescriptorType::eUniformBuffer)
+                             .setOffset(i * sizeof(impl::DescriptorInfo))
+                             .setStride(sizeof(impl::DescriptorInfo)));
+    infos[i].buffer = vk::DescriptorBufferInfo(buffer, i * kRange, kRange);
+  }
+  auto layout = device.createDescriptorSetLayout(
+      vk::DescriptorSetLayoutCreateInfo().setBindings(bindings));
+
+  auto poolSize = vk::DescriptorPoolSize()
+                      .setType(vk::DescriptorType::eUniformBuffer)
+                      .setDescriptorCount(count);
+  auto pool = device.createDescriptorPool(
+      vk::DescriptorPoolCreateInfo().setMaxSets(1).setPoolSizes(poolSize));
+  auto set = device.allocateDescriptorSets(vk::DescriptorSetAllocateInfo()
+                                               .setDescriptorPool(pool)
+                                               .setSetLayouts(layout))[0];
+
+  auto updateTemplate = device.createDescriptorUpdateTemplate(
+      vk::DescriptorUpdateTemplateCreateInfo()
+          .setDescriptorUpdateEntries(entries)
+          .setTemplateType(vk::DescriptorUpdateTemplateType::eDescriptorSet)
+          .setDescriptorSetLayout(layout));
+
+  std::vector<vk::WriteDescriptorSet> writes{};
+  for (uint32_t i = 0; i < count; i++) {
+    writes.emplace_back(vk::WriteDescriptorSet()
+                            .setDstSet(set)
+                            .setDstBinding(i)
+                            .setDescriptorCount(1)
+                            .setDescriptorType(
+                                vk::DescriptorType::eUniformBuffer)
+                            .setPBufferInfo(&infos[i].buffer));
+  }
+
+  // Warm up both paths before timing.
+  device.updateDescriptorSetWithTemplate(set, updateTemplate, infos.data());
+  device.updateDescriptorSets(writes, nullptr);
+
+  auto templated = TimeNs(iterations, [&]() {
+    device.updateDescriptorSetWithTemplate(set, updateTemplate, infos.data());
+  });
+  auto perBinding = TimeNs(iterations, [&]() {
+    for (const auto& e : writes) {
+      device.updateDescriptorSets(1, &e, 0, nullptr);
+    }
+  });
+
+  std::cout << iterations << " updates of a set with " << count
+            << " uniform buffers\n"
+            << "  template:    " << templated << " ns per set\n"
+            << "  per binding: " << perBinding << " ns per set\n"
+            << "  speedup:     " << perBinding / templated << "x" << std::endl;
+
+  device.destroy(updateTemplate);
+  device.destroy(pool);
+  device.destroy(layout);
+  device.destroy(buffer);
+  device.free(memory);
+  device.destroy();
+  instance.destroy();
+  return 0;
+}
@@ -0,0 +1,167 @@
+#include "LayoutHeader.h"
+
+#include <cctype>
+#include <fstream>
+#include <map>
+#include <sstream>
+
+using namespace VPP;
+
+struct CppType {
+  const char* name;
+  uint32_t size;
+};
+
+// Types whose C++ layout matches std140 and std430 alike. Matrices need
+// four rows so every column is a full vec4.
+static const std::map<std::string, CppType> kTypes{
+    {"float", {"float", 4}},         {"int", {"int32_t", 4}},
+    {"uint", {"uint32_t", 4}},       {"bool", {"uint32_t", 4}},
+    {"double", {"double", 8}},       {"vec2", {"glm::vec2", 8}},
+    {"vec3", {"glm::vec3", 12}},     {"vec4", {"glm::vec4", 16}},
+    {"ivec2", {"glm::ivec2", 8}},    {"ivec3", {"glm::ivec3", 12}},
+    {"ivec4", {"glm::ivec4", 16}},   {"uvec2", {"glm::uvec2", 8}},
+    {"uvec3", {"glm::uvec3", 12}},   {"uvec4", {"glm::uvec4", 16}},
+    {"mat2x4", {"glm::mat2x4", 32}}, {"mat3x4", {"glm::mat3x4", 48}},
+    {"mat4", {"glm::mat4", 64}},
+};
+
+static std::string GetIdentifier(const std::string& name) {
+  std::string result{};
+  for (auto c : name) {
+    if (isalnum((unsigned char)c) || c == '_') {
+      result += c;
+    } else if (c == '.' || c == '[') {
+      result += '_';
+    }
+  }
+  return result;
+}
+
+static std::string GetStages(vk::ShaderStageFlags stages) {
+  std::string result{};
+  for (uint32_t i = 0; i < 32; i++) {
+    auto bit = (vk::ShaderStageFlagBits)(1u << i);
+    if (!(stages & bit)) {
+      continue;
+    }
+    if (!result.empty()) {
+      result += " | ";
+    }
+    result += "vk::ShaderStageFlagBits::e" + vk::to_string(bit);
+  }
+  return result.empty() ? "vk::ShaderStageFlags()" : result;
+}
+
+static void WriteBlock(std::ostream& out, const glsl::Uniform& block) {
+  auto name = GetIdentifier(block.name);
+  std::ostringstream asserts{};
+  out << "struct " << name << " {\n";
+
+  uint32_t offset = 0;
+  uint32_t padding = 0;
+  for (const auto& e : block.members) {
+    if (e.size == 0) {
+      out << "  // " << e.name << ": runtime sized, not mirrored\n";
+      continue;
+    }
+    if (e.offset > offset) {
+      out << "  uint8_t pad" << padding++ << "[" << e.offset - offset << "];\n";
+    }
+
+    // A trailing [0] is how reflection names arrays.
+    auto member = e.name;
+    if (e.count > 1 && member.size() > 3 &&
+        member.compare(member.size() - 3, 3, "[0]") == 0) {
+      member.resize(member.size() - 3);
+    }
+    member = GetIdentifier(member);
+
+    // Array strides are only known to match for vec4 sized elements,
+    // anything else is left as raw bytes of the member's span.
+    auto type = kTypes.find(e.type);
+    uint32_t size = e.size;
+    if (type != kTypes.end() &&
+        (e.count == 1 || type->second.size % 16 == 0) &&
+        type->second.size * e.count <= e.size) {
+      size = type->second.size * e.count;
+      out << "  " << type->second.name << " " << member;
+      if (e.count > 1) {
+        out << "[" << e.count << "]";
+      }
+      out << ";\n";
+    } else {
+      out << "  uint8_t " << member << "[" << size << "]; // " << e.type
+          << "\n";
+    }
+    asserts << "static_assert(offsetof(" << name << ", " << member
+            << ") == " << e.offset << ", \"\");\n";
+    offset = e.offset + size;
+  }
+  if (block.block_size > offset) {
+    out << "  uint8_t pad" << padding++ << "[" << block.block_size - offset
+        << "];\n";
+  }
+  out << "};\n" << asserts.str();
+  if (block.block_size) {
+    out << "static_assert(sizeof(" << name << ") == " << block.block_size
+        << ", \"\");\n";
+  }
+  out << "\n";
+}
+
+bool WriteLayoutHeader(const std::string& fn, const std::string& program,
+                       const glsl::MetaData& data) {
+  std::ofstream out(fn, std::ios::trunc);
+  if (!out.is_open()) {
+    return false;
+  }
+
+  out << "// Generated by ShaderCompiler from " << program
+      << ", do not edit.\n"
+         "#pragma once\n\n"
+         "#include <cstddef>\n"
+         "#include <cstdint>\n\n"
+         "#include <glm/glm.hpp>\n"
+         "#include <vulkan/vulkan.hpp>\n\n"
+         "namespace shaders {\n"
+         "namespace "
+      << GetIdentifier(program) << " {\n\n";
+
+  std::map<uint32_t, std::vector<const glsl::Uniform*>> sets{};
+  for (const auto& e : data.uniforms) {
+    sets[e.set].push_back(&e);
+  }
+  for (const auto& e : sets) {
+    out << "constexpr vk::DescriptorSetLayoutBinding kSet" << e.first
+        << "[] = {\n";
+    for (const auto* uniform : e.second) {
+      out << "    {" << uniform->binding << ", vk::DescriptorType::e"
+          << vk::to_string(uniform->type) << ", " << uniform->count << ", "
+          << GetStages(uniform->stages) << "},\n";
+    }
+    out << "};\n";
+  }
+  if (!sets.empty()) {
+    out << "\n";
+  }
+
+  if (!data.pushes.empty()) {
+    out << "constexpr vk::PushConstantRange kPushConstants[] = {\n";
+    for (const auto& e : data.pushes) {
+      out << "    {" << GetStages(e.stages) << ", 0, " << e.size << "},\n";
+    }
+    out << "};\n\n";
+  }
+
+  for (const auto& e : data.uniforms) {
+    if (!e.members.empty()) {
+      WriteBlock(out, e);
+    }
+  }
+
+  out << "} // namespace " << GetIdentifier(program)
+      << "\n"
+         "} // namespace shaders\n";
+  return !!out;
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <string>
+
+#include "impl/ShaderData.h"
+
+// Writes a header with constexpr set layouts, push constant ranges and one
+// struct per uniform/storage block of the program, the offsets checked by
+// static_assert.
+bool WriteLayoutHeader(const std::string& fn, const std::string& program,
+                       const VPP::glsl::MetaData& data);
@@ -0,0 +1,150 @@
+#include <cstring>
+#include <future>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+#include "LayoutHeader.h"
+#include "impl/ShaderArchive.h"
+#include "impl/ShaderData.h"
+#include "impl/VPPShader.h"
+
+using namespace VPP;
+
+static const char* kStages[] = {"vert", "tesc", "tese", "geom", "frag", "comp"};
+
+static bool ListFiles(const std::string& dir, std::vector<std::string>& files) {
+#ifdef _WIN32
+  WIN32_FIND_DATAA data{};
+  auto handle = FindFirstFileA((dir + "/*").c_str(), &data);
+  if (handle == INVALID_HANDLE_VALUE) {
+    return false;
+  }
+  do {
+    if (!(data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
+      files.push_back(data.cFileName);
+    }
+  } while (FindNextFileA(handle, &data));
+  FindClose(handle);
+#else
+  auto* handle = opendir(dir.c_str());
+  if (!handle) {
+    return false;
+  }
+  while (auto* entry = readdir(handle)) {
+    if (entry->d_type != DT_DIR) {
+      files.push_back(entry->d_name);
+    }
+  }
+  closedir(handle);
+#endif
+  return true;
+}
+
+// Stages sharing a file name form one program, basic.vert and basic.frag
+// become "basic".
+static std::map<std::string, std::vector<std::string>>
+GroupPrograms(const std::string& dir, const std::vector<std::string>& files) {
+  std::map<std::string, std::vector<std::string>> programs{};
+  for (const auto& fn : files) {
+    auto dot = fn.rfind('.');
+    if (dot == std::string::npos) {
+      continue;
+    }
+    auto ext = fn.substr(dot + 1);
+    for (auto stage : kStages) {
+      if (ext == stage) {
+        programs[fn.substr(0, dot)].push_back(dir + "/" + fn);
+        break;
+      }
+    }
+  }
+  return programs;
+}
+
+static void Usage() {
+  std::cerr << "Usage: ShaderCompiler <asset dir> <archive> [options]\n"
+               "  -O  optimize for performance\n"
+               "  -Os optimize for size\n"
+               "  -s  strip debug info\n"
+               "  -h <dir> write a layout header per program"
+            << std::endl;
+}
+
+int main(int argc, char** argv) {
+  if (argc < 3) {
+    Usage();
+    return 1;
+  }
+
+  glsl::CompileOptions options{};
+  std::string headers{};
+  for (int i = 3; i < argc; i++) {
+    if (strcmp(argv[i], "-O") == 0) {
+      options.optimize = glsl::OptimizeLevel::kPerformance;
+    } else if (strcmp(argv[i], "-Os") == 0) {
+      options.optimize = glsl::OptimizeLevel::kSize;
+    } else if (strcmp(argv[i], "-s") == 0) {
+      options.strip_debug = true;
+    } else if (strcmp(argv[i], "-h") == 0 && i + 1 < argc) {
+      headers = argv[++i];
+    } else {
+      Usage();
+      return 1;
+    }
+  }
+
+  if (!headers.empty()) {
+#ifdef _WIN32
+    CreateDirectoryA(headers.c_str(), nullptr);
+#else
+    mkdir(headers.c_str(), 0755);
+#endif
+  }
+
+  std::string dir = argv[1];
+  std::vector<std::string> files{};
+  if (!ListFiles(dir, files)) {
+    std::cerr << "Fail to list directory: " << dir << std::endl;
+    return 1;
+  }
+
+  auto programs = GroupPrograms(dir, files);
+  std::map<std::string, std::future<glsl::MetaData>> jobs{};
+  for (const auto& e : programs) {
+    jobs[e.first] = glsl::Compiler::Get().Compile(e.second, options);
+  }
+
+  int result = 0;
+  std::map<std::string, glsl::MetaData> compiled{};
+  for (auto& e : jobs) {
+    auto data = e.second.get();
+    if (data.spvs.empty()) {
+      std::cerr << "Fail to compile program: " << e.first << std::endl;
+      result = 1;
+      continue;
+    }
+    if (!headers.empty() &&
+        !WriteLayoutHeader(headers + "/" + e.first + ".h", e.first, data)) {
+      std::cerr << "Fail to write layout header: " << e.first << std::endl;
+      result = 1;
+    }
+    compiled[e.first].Swap(std::move(data));
+  }
+
+  if (!glsl::WriteArchive(argv[2], compiled)) {
+    std::cerr << "Fail to write archive: " << argv[2] << std::endl;
+    return 1;
+  }
+  std::cout << compiled.size() << " programs written to " << argv[2]
+            << std::endl;
+  return result;
+}